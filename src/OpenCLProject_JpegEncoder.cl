@@ -2,182 +2,414 @@
 #include <OpenCL/OpenCLKernel.hpp> // Hack to make syntax highlighting in Eclipse work
 #endif
 
-__kernel void colorConversionKernel(__global uint* d_input, __global uint* d_output, const unsigned int width, const unsigned int height) {
-    size_t i = get_global_id(0);
-    size_t j = get_global_id(1);
+// chroma subsampling: horizontal and vertical Y samples per Cb and Cr sample (2, 2 = 4:2:0)
+#ifndef CHROMA_SUBSAMPLING_X
+#define CHROMA_SUBSAMPLING_X 2
+#endif
+#ifndef CHROMA_SUBSAMPLING_Y
+#define CHROMA_SUBSAMPLING_Y 2
+#endif
 
-    size_t countX = get_global_size(0);
-    size_t countY = get_global_size(1);
+// components of the image: 3 = Y, Cb, Cr; 1 = Y only (grayscale, built with subsampling 1, 1)
+#ifndef NUM_COMPONENTS
+#define NUM_COMPONENTS 3
+#endif
 
-    if (i >= width || j >= height) {
-        return;
-    }
+// an MCU holds CHROMA_SUBSAMPLING_X * CHROMA_SUBSAMPLING_Y Y blocks followed by one Cb and one Cr block
+// (a single Y block for grayscale images)
+#define MCU_LUMA_BLOCKS (CHROMA_SUBSAMPLING_X * CHROMA_SUBSAMPLING_Y)
+#define MCU_BLOCKS (MCU_LUMA_BLOCKS + NUM_COMPONENTS - 1)
 
-    // get pixel values
-    uint red_pixel = d_input[j * width + i];
-    uint green_pixel = d_input[width * height + j * width + i];
-    uint blue_pixel = d_input[2 * width * height + j * width + i];
+// width and height of a plane (0 = Y, 1 = Cb, 2 = Cr) of the subsampled image,
+// the Y plane (width x height) is padded to whole MCUs
+size_t planeWidth(size_t channel, size_t width) {
+    return (channel == 0) ? width : width / CHROMA_SUBSAMPLING_X;
+}
 
-    // use formula to convert to YCbCr
-    uint y = (uint)(0.299f * red_pixel + 0.587f * green_pixel + 0.114f * blue_pixel);
-    uint u = (uint)(-0.169f * red_pixel - 0.331f * green_pixel + 0.500f * blue_pixel + 128);
-    uint v = (uint)(0.500f * red_pixel - 0.419f * green_pixel - 0.081f * blue_pixel + 128);
+size_t planeHeight(size_t channel, size_t height) {
+    return (channel == 0) ? height : height / CHROMA_SUBSAMPLING_Y;
+}
 
-    d_output[j * width + i] = y;
-    d_output[width * height + j * width + i] = u;
-    d_output[2 * width * height + j * width + i] = v;
+// offset of a plane of the subsampled image: the Y plane is followed by the Cb and the Cr plane
+// (same layout as sample_image_t and coeff_image_t on the host)
+size_t planeOffset(size_t channel, size_t width, size_t height) {
+    return (channel == 0) ? 0 : width * height + (channel - 1) * planeWidth(1, width) * planeHeight(1, height);
 }
 
-__kernel void chromaSubsamplingKernel(__global uint* d_input, __global uint* d_output, const unsigned int width, const unsigned int height) {
-    size_t i = get_global_id(0);
-    size_t j = get_global_id(1);
+// position in a row or column of length size at position x of the padded row or column:
+// the padding repeats the samples in front of the edge in reverse order, rows and columns shorter than the padding
+// repeat their first sample (as copyToLargerSampleImage)
+size_t mirrorIndex(size_t x, size_t size) {
+    return (x < size) ? x : (x < 2 * size ? 2 * size - x - 1 : 0);
+}
 
-    size_t countX = get_global_size(0);
-    size_t countY = get_global_size(1);
+// index of the pixel of the original image (width x height) at position (x, y) of the padded image
+size_t paddedSourceIndex(size_t x, size_t y, size_t width, size_t height) {
+    return mirrorIndex(y, height) * width + mirrorIndex(x, width);
+}
 
+// fixed-point color conversion of the CPU path (color.cpp): constants round(x * 2^14), the rounding and the
+// level shift are folded into the offsets, the samples are descaled with an arithmetic shift and saturated
+#define CSC_FIX_BITS 14
+#define CSC_Y_R   4899  //  0.299
+#define CSC_Y_G   9617  //  0.587
+#define CSC_Y_B   1868  //  0.114
+#define CSC_CB_R -2765  // -0.168736
+#define CSC_CB_G -5427  // -0.331264
+#define CSC_CB_B  8192  //  0.5
+#define CSC_CR_R  8192  //  0.5
+#define CSC_CR_G -6860  // -0.418688
+#define CSC_CR_B -1332  // -0.081312
+#define CSC_Y_OFFSET ((1 << (CSC_FIX_BITS - 1)) - (128 << CSC_FIX_BITS))
+#define CSC_C_OFFSET (1 << (CSC_FIX_BITS - 1))
+
+// the Cb and Cr samples are averaged with a shift (rounding down, as downsampleChromaRow)
+#define CHROMA_AVERAGE_SHIFT ((CHROMA_SUBSAMPLING_X - 1) + (CHROMA_SUBSAMPLING_Y - 1))
+
+int descaleSample(int x) {
+    x >>= CSC_FIX_BITS;
+    return (x < -128) ? -128 : (x > 127 ? 127 : x);
+}
 
-    size_t eff_i = i * 2;
-    size_t eff_j = j * 2;
+// level shifted Y sample at position (x, y) of the padded image (the Y plane is padded at full resolution)
+// d_input holds the interleaved R, G and B bytes of the original image (width x height), one gray byte per pixel for grayscale images
+int lumaSample(__global const uchar* d_input, size_t x, size_t y, size_t width, size_t height) {
+    size_t src = paddedSourceIndex(x, y, width, height);
+#if NUM_COMPONENTS == 3
+    int r = d_input[3 * src];
+    int g = d_input[3 * src + 1];
+    int b = d_input[3 * src + 2];
+    return descaleSample(CSC_Y_R * r + CSC_Y_G * g + CSC_Y_B * b + CSC_Y_OFFSET);
+#else
+    // grayscale: Y = R = G = B
+    return (int)d_input[src] - 128;
+#endif
+}
 
-    if (eff_i >= width || eff_j >= height) {
-        return;
+#if NUM_COMPONENTS == 3
+// level shifted Cb and Cr samples at position (i, j) of the padded chroma planes, in the order of the host:
+// the planes of the original image are subsampled first (the last column and row of odd sizes are averaged
+// with themselves) and then padded at chroma resolution
+void chromaSamples(__global const uchar* d_input, size_t i, size_t j, size_t width, size_t height, int* cb, int* cr) {
+    size_t ci = mirrorIndex(i, (width + CHROMA_SUBSAMPLING_X - 1) / CHROMA_SUBSAMPLING_X);
+    size_t cj = mirrorIndex(j, (height + CHROMA_SUBSAMPLING_Y - 1) / CHROMA_SUBSAMPLING_Y);
+    int sumCb = 0;
+    int sumCr = 0;
+    for (int y = 0; y < CHROMA_SUBSAMPLING_Y; y++) {
+        for (int x = 0; x < CHROMA_SUBSAMPLING_X; x++) {
+            size_t px = ci * CHROMA_SUBSAMPLING_X + x;
+            size_t py = cj * CHROMA_SUBSAMPLING_Y + y;
+            size_t src = ((py < height) ? py : height - 1) * width + ((px < width) ? px : width - 1);
+            int r = d_input[3 * src];
+            int g = d_input[3 * src + 1];
+            int b = d_input[3 * src + 2];
+            sumCb += descaleSample(CSC_CB_R * r + CSC_CB_G * g + CSC_CB_B * b + CSC_C_OFFSET);
+            sumCr += descaleSample(CSC_CR_R * r + CSC_CR_G * g + CSC_CR_B * b + CSC_C_OFFSET);
+        }
     }
-
-    // 
-    size_t pixel_1_index = eff_j * width + eff_i;
-    size_t pixel_2_index = eff_j * width + eff_i + 1;
-    size_t pixel_3_index = (eff_j + 1) * width + eff_i;
-    size_t pixel_4_index = (eff_j + 1) * width + eff_i + 1;
-
-    // get cb and cr values
-    uint cb1 = d_input[pixel_1_index + width * height];
-    uint cb2 = d_input[pixel_2_index + width * height];
-    uint cb3 = d_input[pixel_3_index + width * height];
-    uint cb4 = d_input[pixel_4_index + width * height];
-
-    uint cr1 = d_input[pixel_1_index + 2 * width * height];
-    uint cr2 = d_input[pixel_2_index + 2 * width * height];
-    uint cr3 = d_input[pixel_3_index + 2 * width * height];
-    uint cr4 = d_input[pixel_4_index + 2 * width * height];
-
-    // average the values
-    uint cb = (uint)((cb1 + cb2 + cb3 + cb4) / 4.0);
-    uint cr = (uint)((cr1 + cr2 + cr3 + cr4) / 4.0);
-
-    d_output[pixel_1_index + width * height] = cb;
-    d_output[pixel_2_index + width * height] = cb;
-    d_output[pixel_3_index + width * height] = cb;
-    d_output[pixel_4_index + width * height] = cb;
-
-    d_output[pixel_1_index + 2 * width * height] = cr;
-    d_output[pixel_2_index + 2 * width * height] = cr;
-    d_output[pixel_3_index + 2 * width * height] = cr;
-    d_output[pixel_4_index + 2 * width * height] = cr;
-
-    // almost forgot the y values
-    d_output[pixel_1_index] = d_input[pixel_1_index];
-    d_output[pixel_2_index] = d_input[pixel_2_index];
-    d_output[pixel_3_index] = d_input[pixel_3_index];
-    d_output[pixel_4_index] = d_input[pixel_4_index];
+    *cb = sumCb >> CHROMA_AVERAGE_SHIFT;
+    *cr = sumCr >> CHROMA_AVERAGE_SHIFT;
 }
+#endif
 
-__kernel void LevelShiftKernel(__global float* d_input, __global float* d_output, const unsigned int width, const unsigned int height) {
+// Color conversion, chroma subsampling and level shift in one pass. d_input holds the interleaved R, G and B
+// bytes of the original image (width x height, as read from the PPM file, one gray byte per pixel for grayscale images), d_output receives the level shifted Y plane and the subsampled Cb and Cr
+// planes of the image padded to whole MCUs (paddedWidth x paddedHeight, see planeOffset).
+// One work item per Cb/Cr sample: it converts the pixels it covers, writes their Y samples and the average
+// of their Cb and Cr samples. No full size Cb and Cr planes are stored. The samples are the same as those of
+// the CPU path (performCSCFused followed by copyToLargerSampleImage).
+__kernel void colorConversionSubsamplingKernel(__global const uchar* d_input, __global float* d_output, const unsigned int width, const unsigned int height, const unsigned int paddedWidth, const unsigned int paddedHeight) {
     size_t i = get_global_id(0);
     size_t j = get_global_id(1);
 
-    size_t countX = get_global_size(0);
-    size_t countY = get_global_size(1);
+    size_t chromaWidth = planeWidth(1, paddedWidth);
+    size_t chromaHeight = planeHeight(1, paddedHeight);
 
-    if (i >= width || j >= height) {
+    if (i >= chromaWidth || j >= chromaHeight) {
         return;
     }
 
-    size_t pixel_index = j * width + i;
+    for (int y = 0; y < CHROMA_SUBSAMPLING_Y; y++) {
+        for (int x = 0; x < CHROMA_SUBSAMPLING_X; x++) {
+            size_t px = i * CHROMA_SUBSAMPLING_X + x;
+            size_t py = j * CHROMA_SUBSAMPLING_Y + y;
+            d_output[py * paddedWidth + px] = (float)lumaSample(d_input, px, py, width, height);
+        }
+    }
 
-    // level shift
-    d_output[pixel_index] = d_input[pixel_index] - 128;
-    d_output[width * height + pixel_index] = d_input[width * height + pixel_index] - 128;
-    d_output[2 * width * height + pixel_index] = d_input[2 * width * height + pixel_index] - 128;
+#if NUM_COMPONENTS == 3
+    int cb, cr;
+    chromaSamples(d_input, i, j, width, height, &cb, &cr);
+    size_t chroma_index = j * chromaWidth + i;
+    d_output[planeOffset(1, paddedWidth, paddedHeight) + chroma_index] = (float)cb;
+    d_output[planeOffset(2, paddedWidth, paddedHeight) + chroma_index] = (float)cr;
+#endif
 }
 
+// One work item per Y coefficient, the work items inside the Cb and Cr planes also compute
+// the coefficients of these planes at the same position
 __kernel void DCTKernel(__global float* d_input, __global float* d_output, const unsigned int width, const unsigned int height) {
     size_t i = get_global_id(0);
     size_t j = get_global_id(1);
 
-    size_t countX = get_global_size(0);
-    size_t countY = get_global_size(1);
-
-    if (i >= width || j >= height) {
-        return;
-    }
-
     float alphaU = (i % 8 == 0) ? 1.0f / sqrt(2.0f) : 1.0f;
     float alphaV = (j % 8 == 0) ? 1.0f / sqrt(2.0f) : 1.0f;
 
-    float sumY = 0.0f;
-    float sumCb = 0.0f;
-    float sumCr = 0.0f;
-
     int startX = (i / 8) * 8;
     int startY = (j / 8) * 8;
 
     int u = i % 8;
     int v = j % 8;
 
-    // perform DCT by parsing through 8x8 block (inner loops)
-    for (int y = 0; y < 8; y++) {
-        for (int x = 0; x < 8; x++) {
+    for (size_t c = 0; c < NUM_COMPONENTS; c++) {
+        size_t pw = planeWidth(c, width);
+        if (i >= pw || j >= planeHeight(c, height)) {
+            continue;
+        }
+        __global float* plane = d_input + planeOffset(c, width, height);
 
-            float cosX = cos((2 * x + 1) * u * M_PI / 16.0f);
-            float cosY = cos((2 * y + 1) * v * M_PI / 16.0f);
+        float sum = 0.0f;
 
-            sumY += d_input[(startY + y) * width + startX + x] * cosX * cosY;
-            sumCb += d_input[(startY + y) * width + startX + x + width * height] * cosX * cosY;
-            sumCr += d_input[(startY + y) * width + startX + x + 2 * width * height] * cosX * cosY;
+        // perform DCT by parsing through 8x8 block (inner loops)
+        for (int y = 0; y < 8; y++) {
+            for (int x = 0; x < 8; x++) {
+
+                float cosX = cos((2 * x + 1) * u * M_PI / 16.0f);
+                float cosY = cos((2 * y + 1) * v * M_PI / 16.0f);
+
+                sum += plane[(startY + y) * pw + startX + x] * cosX * cosY;
+            }
         }
+
+        sum *= 0.25f * alphaU * alphaV;
+
+        d_output[planeOffset(c, width, height) + j * pw + i] = sum;
     }
+}
 
-    sumY *= 0.25f * alphaU * alphaV;
-    sumCb *= 0.25f * alphaU * alphaV;
-    sumCr *= 0.25f * alphaU * alphaV;
+// Separable DCT on 8x8 tiles in local memory. The work group (a multiple of 8 in both dimensions) loads its
+// tiles of all three channels once, then every work item computes one value of the row pass and, after a
+// barrier, one coefficient of the column pass. dctMatrix[u * 8 + x] is the basis matrix (see getDCTMatrix).
+// tile and rowPass hold NUM_COMPONENTS * work group size floats each. The work items cover the Y plane, the ones
+// outside of the (smaller) Cb and Cr planes skip these channels.
+__kernel void DCTTiledKernel(__global float* d_input, __global float* d_output, __constant float* dctMatrix, __local float* tile, __local float* rowPass, const unsigned int width, const unsigned int height) {
+    size_t i = get_global_id(0);
+    size_t j = get_global_id(1);
+    size_t li = get_local_id(0);
+    size_t lj = get_local_id(1);
+    size_t localWidth = get_local_size(0);
+    size_t localSize = localWidth * get_local_size(1);
+    size_t localIndex = lj * localWidth + li;
+
+    // work items outside of a plane take part in the barriers, but do not read or write the plane
+    int inside[NUM_COMPONENTS];
+    for (int c = 0; c < NUM_COMPONENTS; c++) {
+        inside[c] = (i < planeWidth(c, width) && j < planeHeight(c, height));
+    }
 
-    d_output[j * width + i] = sumY;
-    d_output[width * height + j * width + i] = sumCb;
-    d_output[2 * width * height + j * width + i] = sumCr;
+    for (int c = 0; c < NUM_COMPONENTS; c++) {
+        tile[c * localSize + localIndex] = inside[c] ? d_input[planeOffset(c, width, height) + j * planeWidth(c, width) + i] : 0.0f;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // row pass: coefficient u of row lj of the tile
+    size_t u = li % 8;
+    size_t tileX = li - u;
+    for (int c = 0; c < NUM_COMPONENTS; c++) {
+        __local float* row = tile + c * localSize + lj * localWidth + tileX;
+        float sum = 0.0f;
+        for (int x = 0; x < 8; x++) {
+            sum += dctMatrix[u * 8 + x] * row[x];
+        }
+        rowPass[c * localSize + localIndex] = sum;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // column pass: coefficient v of column li of the tile
+    size_t v = lj % 8;
+    size_t tileY = lj - v;
+    for (int c = 0; c < NUM_COMPONENTS; c++) {
+        __local float* column = rowPass + c * localSize + tileY * localWidth + li;
+        float sum = 0.0f;
+        for (int y = 0; y < 8; y++) {
+            sum += dctMatrix[v * 8 + y] * column[y * localWidth];
+        }
+        if (inside[c]) {
+            d_output[planeOffset(c, width, height) + j * planeWidth(c, width) + i] = sum;
+        }
+    }
 }
 
-__kernel void quantizationKernel(__global float* d_input, __global int* d_output, __global uint* quant_lum, __global uint* quant_chrom, const unsigned int width, const unsigned int height) {
+// index of coefficient (i, j) of a channel in the quantized output: the 8x8 blocks are stored one after
+// another in raster order, with the 64 coefficients of a block next to each other (row major)
+size_t coeffIndex(size_t i, size_t j, size_t width) {
+    return ((j / 8) * (width / 8) + i / 8) * 64 + (j % 8) * 8 + (i % 8);
+}
+
+// quantized coefficients are stored as short (16 bit), which halves the traffic of the following kernels
+// One work item per Y coefficient, the work items inside the Cb and Cr planes also quantize these planes
+__kernel void quantizationKernel(__global float* d_input, __global short* d_output, __global uint* quant_lum, __global uint* quant_chrom, const unsigned int width, const unsigned int height) {
     size_t i = get_global_id(0);
     size_t j = get_global_id(1);
 
-    size_t countX = get_global_size(0);
-    size_t countY = get_global_size(1);
+    // position of the coefficient within its 8x8 block
+    size_t quant_index = (j % 8) * 8 + (i % 8);
+
+    for (size_t c = 0; c < NUM_COMPONENTS; c++) {
+        size_t pw = planeWidth(c, width);
+        if (i >= pw || j >= planeHeight(c, height)) {
+            continue;
+        }
+        size_t offset = planeOffset(c, width, height);
+        __global uint* quant = (c == 0) ? quant_lum : quant_chrom;
+
+        // quantize using quantization tables
+        d_output[offset + coeffIndex(i, j, pw)] = (short)round(d_input[offset + j * pw + i] / (float)quant[quant_index]);
+    }
+}
+
+// fixed-point constants of the integer DCT, must match src/dct.cpp for bit-identical coefficients
+#define INT_CONST_BITS 13
+#define INT_PASS1_BITS 2
+#define FIX_0_298631336  2446
+#define FIX_0_390180644  3196
+#define FIX_0_541196100  4433
+#define FIX_0_765366865  6270
+#define FIX_0_899976223  7373
+#define FIX_1_175875602  9633
+#define FIX_1_501321110 12299
+#define FIX_1_847759065 15137
+#define FIX_1_961570560 16069
+#define FIX_2_053119869 16819
+#define FIX_2_562915447 20995
+#define FIX_3_072711026 25172
+
+// shift right with rounding
+int descaleInt(int x, int n) {
+    return (x + (1 << (n - 1))) >> n;
+}
+
+// 1-D integer DCT on 8 values with the given stride (same operations as performDCTInt1DScalar on the CPU)
+void performDCTInt1D(int* d, int stride, int firstPass) {
+    int descale = firstPass ? INT_CONST_BITS - INT_PASS1_BITS : INT_CONST_BITS + INT_PASS1_BITS;
+
+    int tmp0 = d[0 * stride] + d[7 * stride];
+    int tmp7 = d[0 * stride] - d[7 * stride];
+    int tmp1 = d[1 * stride] + d[6 * stride];
+    int tmp6 = d[1 * stride] - d[6 * stride];
+    int tmp2 = d[2 * stride] + d[5 * stride];
+    int tmp5 = d[2 * stride] - d[5 * stride];
+    int tmp3 = d[3 * stride] + d[4 * stride];
+    int tmp4 = d[3 * stride] - d[4 * stride];
+
+    // even part
+    int tmp10 = tmp0 + tmp3;
+    int tmp13 = tmp0 - tmp3;
+    int tmp11 = tmp1 + tmp2;
+    int tmp12 = tmp1 - tmp2;
+
+    if (firstPass) {
+        d[0 * stride] = (tmp10 + tmp11) * (1 << INT_PASS1_BITS);
+        d[4 * stride] = (tmp10 - tmp11) * (1 << INT_PASS1_BITS);
+    } else {
+        d[0 * stride] = descaleInt(tmp10 + tmp11, INT_PASS1_BITS);
+        d[4 * stride] = descaleInt(tmp10 - tmp11, INT_PASS1_BITS);
+    }
+
+    int z1 = (tmp12 + tmp13) * FIX_0_541196100;
+    d[2 * stride] = descaleInt(z1 + tmp13 * FIX_0_765366865, descale);
+    d[6 * stride] = descaleInt(z1 - tmp12 * FIX_1_847759065, descale);
+
+    // odd part
+    z1 = tmp4 + tmp7;
+    int z2 = tmp5 + tmp6;
+    int z3 = tmp4 + tmp6;
+    int z4 = tmp5 + tmp7;
+    int z5 = (z3 + z4) * FIX_1_175875602;
+
+    tmp4 = tmp4 * FIX_0_298631336;
+    tmp5 = tmp5 * FIX_2_053119869;
+    tmp6 = tmp6 * FIX_3_072711026;
+    tmp7 = tmp7 * FIX_1_501321110;
+    z1 = z1 * -FIX_0_899976223;
+    z2 = z2 * -FIX_2_562915447;
+    z3 = z3 * -FIX_1_961570560 + z5;
+    z4 = z4 * -FIX_0_390180644 + z5;
+
+    d[7 * stride] = descaleInt(tmp4 + z1 + z3, descale);
+    d[5 * stride] = descaleInt(tmp5 + z2 + z4, descale);
+    d[3 * stride] = descaleInt(tmp6 + z2 + z3, descale);
+    d[1 * stride] = descaleInt(tmp7 + z1 + z4, descale);
+}
+
+// Integer DCT: one work item per 8x8 block (global id 0, 1) and channel (global id 2)
+// The global size covers the blocks of the Y plane, the Cb and Cr planes have fewer blocks
+// The coefficients are scaled by 8 and bit-identical to the integer DCT on the CPU
+__kernel void DCTIntKernel(__global float* d_input, __global int* d_output, const unsigned int width, const unsigned int height) {
+    size_t blockX = get_global_id(0);
+    size_t blockY = get_global_id(1);
+    size_t channel = get_global_id(2);
 
-    if (i >= width || j >= height) {
+    size_t pw = planeWidth(channel, width);
+    if (blockX * 8 >= pw || blockY * 8 >= planeHeight(channel, height)) {
         return;
     }
 
-    size_t pixel_index = j * width + i;
+    size_t offset = planeOffset(channel, width, height) + blockY * 8 * pw + blockX * 8;
 
-    float y = d_input[pixel_index];
-    float u = d_input[width * height + pixel_index];
-    float v = d_input[2 * width * height + pixel_index];
+    // the level shifted samples are integers
+    int block[64];
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 8; x++) {
+            block[y * 8 + x] = (int)d_input[offset + y * pw + x];
+        }
+    }
+
+    for (int i = 0; i < 8; i++) {
+        performDCTInt1D(&block[i * 8], 1, 1);
+    }
+    for (int i = 0; i < 8; i++) {
+        performDCTInt1D(&block[i], 8, 0);
+    }
+
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 8; x++) {
+            d_output[offset + y * pw + x] = block[y * 8 + x];
+        }
+    }
+}
 
-    // quantize using quantization tables
-    d_output[pixel_index] = round(y / (float)quant_lum[pixel_index % 64]);
-    d_output[width * height + pixel_index] = round(u / (float)quant_chrom[pixel_index % 64]);
-    d_output[2 * width * height + pixel_index] = round(v / (float)quant_chrom[pixel_index % 64]);
+// quantize an integer DCT coefficient (scaled by 8), rounding halfway cases away from zero
+int quantizeIntCoefficient(int coeff, uint quant) {
+    int divisor = (int)quant * 8;
+    return (coeff < 0) ? -((-coeff + divisor / 2) / divisor) : (coeff + divisor / 2) / divisor;
 }
 
-__kernel void zigzagKernel(__global int* d_input, __global int* d_output) {
-    size_t i = get_global_id(0); // MCU index
-    size_t j = get_global_id(1); // index within MCU
-    
-    size_t count_i = get_global_size(0);
-    size_t count_j = get_global_size(1);
+__kernel void quantizationIntKernel(__global int* d_input, __global short* d_output, __global uint* quant_lum, __global uint* quant_chrom, const unsigned int width, const unsigned int height) {
+    size_t i = get_global_id(0);
+    size_t j = get_global_id(1);
 
+    // position of the coefficient within its 8x8 block
+    size_t quant_index = (j % 8) * 8 + (i % 8);
 
-    if (i >= count_i || j >= count_j) {
+    for (size_t c = 0; c < NUM_COMPONENTS; c++) {
+        size_t pw = planeWidth(c, width);
+        if (i >= pw || j >= planeHeight(c, height)) {
+            continue;
+        }
+        size_t offset = planeOffset(c, width, height);
+        __global uint* quant = (c == 0) ? quant_lum : quant_chrom;
+
+        d_output[offset + coeffIndex(i, j, pw)] = (short)quantizeIntCoefficient(d_input[offset + j * pw + i], quant[quant_index]);
+    }
+}
+
+// The global size in dimension 0 is rounded up to whole work groups, the work items past the last block return
+__kernel void zigzagKernel(__global const short* d_input, __global short* d_output, const unsigned int numBlocks) {
+    size_t i = get_global_id(0); // block index
+    size_t j = get_global_id(1); // index within block
+
+    if (i >= numBlocks || j >= 64) {
         return;
     }
 
@@ -195,41 +427,468 @@ __kernel void zigzagKernel(__global int* d_input, __global int* d_output) {
     d_output[i * 64 + j] = d_input[i * 64 + zigzag[j]];
 }
 
-__kernel void rleKernel(__global int* d_input, __global int* d_output) {
-    size_t i = get_global_id(0); // MCU index
-    
-    size_t count = get_global_size(0);
+// position of every coefficient of a block (row major) in the zigzag order, the inverse of the table of zigzagKernel
+__constant int zigzagPosition[64] = {  0,  1,  5,  6, 14, 15, 27, 28,
+                                       2,  4,  7, 13, 16, 26, 29, 42,
+                                       3,  8, 12, 17, 25, 30, 41, 43,
+                                       9, 11, 18, 24, 31, 40, 44, 53,
+                                      10, 19, 23, 32, 39, 45, 52, 54,
+                                      20, 22, 33, 38, 46, 51, 55, 60,
+                                      21, 34, 37, 47, 50, 56, 59, 61,
+                                      35, 36, 48, 49, 57, 58, 62, 63 };
+
+// offset of block (blockX, blockY) of a channel in the coefficient planes (blocks stored one after another, see coeffIndex)
+size_t blockOffset(size_t channel, size_t blockX, size_t blockY, size_t width, size_t height) {
+    return planeOffset(channel, width, height) + (blockY * (planeWidth(channel, width) / 8) + blockX) * 64;
+}
 
-    if (i >= count) {
-        return;
+// Fused front end of the encoder: one work group of 8x8 work items per MCU (group id 0, 1 = MCU column and row).
+// The work group converts the RGB pixels of its MCU, subsamples and level shifts them (same formulas as
+// colorConversionSubsamplingKernel), transforms the blocks in local memory, quantizes them and writes the
+// coefficients in zigzag order to the block layout of zigzagKernel. Only the RGB pixels (width x height, interleaved
+// as in colorConversionSubsamplingKernel) are read and only the quantized coefficients of the padded image (paddedWidth x paddedHeight) are written.
+// samples and rowPass hold MCU_BLOCKS * 64 floats each. integerDCT selects the integer DCT (bit-identical to
+// DCTIntKernel and quantizationIntKernel), otherwise the separable DCT of DCTTiledKernel with the basis matrix
+// dctMatrix is used. The integer intermediates stay below 2^24 and are stored exactly in the float buffer.
+__kernel void encodeMCUKernel(__global const uchar* d_input, __global short* d_output, __constant float* dctMatrix, __global uint* quant_lum, __global uint* quant_chrom, __local float* samples, __local float* rowPass, const unsigned int integerDCT, const unsigned int width, const unsigned int height, const unsigned int paddedWidth, const unsigned int paddedHeight) {
+    size_t mcuX = get_group_id(0);
+    size_t mcuY = get_group_id(1);
+    size_t u = get_local_id(0);
+    size_t v = get_local_id(1);
+    size_t index = v * 8 + u;
+
+    // every work item converts the pixels of the Cb/Cr sample (u, v) of the MCU
+    for (int y = 0; y < CHROMA_SUBSAMPLING_Y; y++) {
+        for (int x = 0; x < CHROMA_SUBSAMPLING_X; x++) {
+            // position within the MCU, the Y blocks of the MCU are stored in raster order
+            size_t mx = u * CHROMA_SUBSAMPLING_X + x;
+            size_t my = v * CHROMA_SUBSAMPLING_Y + y;
+            int luma = lumaSample(d_input, mcuX * 8 * CHROMA_SUBSAMPLING_X + mx, mcuY * 8 * CHROMA_SUBSAMPLING_Y + my, width, height);
+            samples[((my / 8) * CHROMA_SUBSAMPLING_X + mx / 8) * 64 + (my % 8) * 8 + mx % 8] = (float)luma;
+        }
     }
+#if NUM_COMPONENTS == 3
+    int cb, cr;
+    chromaSamples(d_input, mcuX * 8 + u, mcuY * 8 + v, width, height, &cb, &cr);
+    samples[MCU_LUMA_BLOCKS * 64 + index] = (float)cb;
+    samples[(MCU_LUMA_BLOCKS + 1) * 64 + index] = (float)cr;
+#endif
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // DCT of all blocks of the MCU, coefficient (u, v) of every block ends up in samples[b * 64 + index]
+    if (integerDCT) {
+        // the 64 work items transform the MCU_BLOCKS * 8 rows, then the columns
+        int d[8];
+        for (size_t r = index; r < MCU_BLOCKS * 8; r += 64) {
+            __local float* row = samples + (r / 8) * 64 + (r % 8) * 8;
+            for (int k = 0; k < 8; k++) {
+                d[k] = (int)row[k];
+            }
+            performDCTInt1D(d, 1, 1);
+            for (int k = 0; k < 8; k++) {
+                row[k] = (float)d[k];
+            }
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
 
-    int count_zeroes = 0;
-    int last_non_zero_index = 0;
+        for (size_t r = index; r < MCU_BLOCKS * 8; r += 64) {
+            __local float* column = samples + (r / 8) * 64 + r % 8;
+            for (int k = 0; k < 8; k++) {
+                d[k] = (int)column[k * 8];
+            }
+            performDCTInt1D(d, 1, 0);
+            for (int k = 0; k < 8; k++) {
+                column[k * 8] = (float)d[k];
+            }
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    } else {
+        // row pass: coefficient u of row v
+        for (size_t b = 0; b < MCU_BLOCKS; b++) {
+            float sum = 0.0f;
+            for (int x = 0; x < 8; x++) {
+                sum += dctMatrix[u * 8 + x] * samples[b * 64 + v * 8 + x];
+            }
+            rowPass[b * 64 + index] = sum;
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
 
-    for (int k = 63; k >= 0; k--) {
-        if (d_input[i * 64 + k] != 0) {
+        // column pass: coefficient v of column u, every work item only reads its own coefficient afterwards
+        for (size_t b = 0; b < MCU_BLOCKS; b++) {
+            float sum = 0.0f;
+            for (int y = 0; y < 8; y++) {
+                sum += dctMatrix[v * 8 + y] * rowPass[b * 64 + y * 8 + u];
+            }
+            samples[b * 64 + index] = sum;
+        }
+    }
+
+    // quantize and store in zigzag order: the Y blocks of the MCU, then the Cb and the Cr block
+    for (size_t b = 0; b < MCU_BLOCKS; b++) {
+        size_t channel = 0;
+        size_t blockX = mcuX * CHROMA_SUBSAMPLING_X + b % CHROMA_SUBSAMPLING_X;
+        size_t blockY = mcuY * CHROMA_SUBSAMPLING_Y + b / CHROMA_SUBSAMPLING_X;
+        if (b >= MCU_LUMA_BLOCKS) {
+            channel = b - MCU_LUMA_BLOCKS + 1;
+            blockX = mcuX;
+            blockY = mcuY;
+        }
+        __global uint* quant = (channel == 0) ? quant_lum : quant_chrom;
+
+        float coeff = samples[b * 64 + index];
+        short value = integerDCT ? (short)quantizeIntCoefficient((int)coeff, quant[index]) : (short)round(coeff / (float)quant[index]);
+        d_output[blockOffset(channel, blockX, blockY, paddedWidth, paddedHeight) + zigzagPosition[index]] = value;
+    }
+}
+
+// Run length encode one block in zigzag order into (run, value) pairs
+// The first pair holds the DC coefficient (0, DC), the AC pairs follow as (zero run, value) with
+// (15, 0) for 16 zeros and (0, 0) as end of block unless the last coefficient is non-zero.
+// Returns the number of pairs, they are only written if d_output is not 0.
+uint rleBlock(__global const short* block, __global short* d_output) {
+    int last_non_zero_index = 0;
+    for (int k = 63; k > 0; k--) {
+        if (block[k] != 0) {
             last_non_zero_index = k;
             break;
         }
     }
 
-    int j;
-    for (j = 0; j <= last_non_zero_index; j++) {
-        if (d_input[i * 64 + j] == 0) {
+    uint num_pairs = 0;
+    if (d_output) {
+        d_output[0] = 0;
+        d_output[1] = block[0];
+    }
+    num_pairs++;
+
+    int count_zeroes = 0;
+    for (int j = 1; j <= last_non_zero_index; j++) {
+        if (block[j] == 0) {
             if (count_zeroes == 15) {
-                d_output[i * 64 + 2 * j] = count_zeroes;
-                d_output[i * 64 + 2 * j + 1] = 0;
+                if (d_output) {
+                    d_output[2 * num_pairs] = 15;
+                    d_output[2 * num_pairs + 1] = 0;
+                }
+                num_pairs++;
                 count_zeroes = 0;
             } else {
                 count_zeroes++;
             }
         } else {
-            d_output[i * 64 + 2 * j] = count_zeroes;
-            d_output[i * 64 + 2 * j + 1] = d_input[i * 64 + j];
+            if (d_output) {
+                d_output[2 * num_pairs] = (short)count_zeroes;
+                d_output[2 * num_pairs + 1] = block[j];
+            }
+            num_pairs++;
             count_zeroes = 0;
         }
     }
-    d_output[i * 64 + 2 * j] = 0;
-    d_output[i * 64 + 2 * j + 1] = 0;
-}
\ No newline at end of file
+
+    if (last_non_zero_index < 63) {
+        if (d_output) {
+            d_output[2 * num_pairs] = 0;
+            d_output[2 * num_pairs + 1] = 0;
+        }
+        num_pairs++;
+    }
+    return num_pairs;
+}
+
+// RLE count pass: number of (run, value) pairs of every block
+__kernel void rleCountKernel(__global const short* d_input, __global uint* d_pairCounts, const unsigned int numBlocks) {
+    size_t i = get_global_id(0); // block index
+
+    if (i >= numBlocks) {
+        return;
+    }
+
+    d_pairCounts[i] = rleBlock(d_input + i * 64, 0);
+}
+
+// RLE compaction pass: write the pairs of every block densely packed at its pair offset (exclusive scan of the counts)
+__kernel void rleCompactKernel(__global const short* d_input, __global const uint* d_pairOffsets, __global short* d_output, const unsigned int numBlocks) {
+    size_t i = get_global_id(0); // block index
+
+    if (i >= numBlocks) {
+        return;
+    }
+
+    rleBlock(d_input + i * 64, d_output + 2 * d_pairOffsets[i]);
+}
+
+// Huffman code tables: 4 tables of 256 entries (DC luma, AC luma, DC chroma, AC chroma),
+// every entry holds (code length << 16) | code
+#define HUFF_DC_LUMA   0
+#define HUFF_AC_LUMA   256
+#define HUFF_DC_CHROMA 512
+#define HUFF_AC_CHROMA 768
+
+// magnitude category and bits of a coefficient (negative values as one's complement)
+uint valueCategory(int value) {
+    uint magnitude = abs(value);
+    return 32 - clz(magnitude);
+}
+
+uint valueBits(int value, uint category) {
+    return (uint)(value + (value >> 31)) & ((1u << category) - 1);
+}
+
+// append length bits to the accumulator and move complete 32 bit words to d_output
+// Words that are shared with the neighbouring blocks (the first one if the block does not
+// start at a word boundary) are merged with atomic_or, words owned by the block are stored.
+void putBits(ulong* acc, uint* accBits, uint* word, uint firstWordShared, __global uint* d_output, uint bits, uint length) {
+    *acc = (*acc << length) | bits;
+    *accBits += length;
+    if (*accBits >= 32) {
+        *accBits -= 32;
+        uint value = (uint)(*acc >> *accBits);
+        if (*word == 0 && firstWordShared) {
+            atomic_or(&d_output[0], value);
+        } else {
+            d_output[*word] = value;
+        }
+        (*word)++;
+    }
+}
+
+// Huffman encode the numPairs (run, value) pairs of one block (see rleBlock), with the DC difference to prevDC
+// Returns the number of bits. Nothing is written if d_output is 0, otherwise the bits are
+// written to the bit stream starting at bit position bitOffset.
+uint encodeBlockBits(__global const short* pairs, uint numPairs, int prevDC, __constant uint* dcTable, __constant uint* acTable, __global uint* d_output, uint bitOffset) {
+    ulong acc = 0;
+    uint accBits = 0;
+    uint word = 0;
+    uint firstWordShared = (bitOffset & 31) != 0;
+    uint numBits = 0;
+    if (d_output) {
+        // start in the word holding bitOffset, the bits in front of it are zero
+        d_output += bitOffset >> 5;
+        accBits = bitOffset & 31;
+    }
+
+    // DC coefficient
+    int diff = pairs[1] - prevDC;
+    uint category = valueCategory(diff);
+    uint entry = dcTable[category];
+    uint length = (entry >> 16) + category;
+    numBits += length;
+    if (d_output) {
+        putBits(&acc, &accBits, &word, firstWordShared, d_output, ((entry & 0xFFFF) << category) | valueBits(diff, category), length);
+    }
+
+    // AC pairs: (zero run, category) symbols, (15, 0) is ZRL and (0, 0) is EOB (both of category 0)
+    for (uint j = 1; j < numPairs; j++) {
+        uint run = pairs[2 * j];
+        int value = pairs[2 * j + 1];
+        category = valueCategory(value);
+        entry = acTable[(run << 4) | category];
+        length = (entry >> 16) + category;
+        numBits += length;
+        if (d_output) {
+            putBits(&acc, &accBits, &word, firstWordShared, d_output, ((entry & 0xFFFF) << category) | valueBits(value, category), length);
+        }
+    }
+
+    // the last partial word may be shared with the next block
+    if (d_output && accBits > 0) {
+        atomic_or(&d_output[word], (uint)(acc << (32 - accBits)));
+    }
+    return numBits;
+}
+
+// index of block k of an MCU in scan order: the Y blocks of the MCU row by row, then the Cb and the Cr block
+// The blocks are stored plane after plane (numMCUs blocks per Cb and Cr plane), the Y plane has
+// mcusPerRow * CHROMA_SUBSAMPLING_X blocks per row
+size_t getScanBlock(size_t mcu, size_t k, size_t numMCUs, size_t mcusPerRow) {
+    if (k < MCU_LUMA_BLOCKS) {
+        size_t blockX = (mcu % mcusPerRow) * CHROMA_SUBSAMPLING_X + k % CHROMA_SUBSAMPLING_X;
+        size_t blockY = (mcu / mcusPerRow) * CHROMA_SUBSAMPLING_Y + k / CHROMA_SUBSAMPLING_X;
+        return blockY * mcusPerRow * CHROMA_SUBSAMPLING_X + blockX;
+    }
+    return MCU_LUMA_BLOCKS * numMCUs + (k - MCU_LUMA_BLOCKS) * numMCUs + mcu;
+}
+
+// DC prediction of block k of an MCU: the DC coefficient of the previous block of the same component in scan order
+// d_pairs holds the RLE pairs of all blocks at d_pairOffsets, the first pair of a block is (0, DC)
+// restartInterval > 0 resets the prediction at the start of every restart interval.
+int getPrevDC(__global const short* d_pairs, __global const uint* d_pairOffsets, size_t mcu, size_t k, size_t numMCUs, size_t mcusPerRow, uint restartInterval) {
+    if (k > 0 && k < MCU_LUMA_BLOCKS) {
+        return d_pairs[2 * d_pairOffsets[getScanBlock(mcu, k - 1, numMCUs, mcusPerRow)] + 1];
+    }
+    // only the first block of every component predicts from the previous MCU
+    if (mcu == 0 || (restartInterval > 0 && mcu % restartInterval == 0)) {
+        return 0;
+    }
+    return d_pairs[2 * d_pairOffsets[getScanBlock(mcu - 1, (k == 0) ? MCU_LUMA_BLOCKS - 1 : k, numMCUs, mcusPerRow)] + 1];
+}
+
+// Huffman length pass: number of bits of every block of the scan
+// d_pairs, d_pairOffsets and d_pairCounts are the compacted output of the RLE passes (plane order, see getScanBlock),
+// d_blockBits[mcu * MCU_BLOCKS + k] receives the bit length in scan order
+// restartInterval: MCUs per restart interval (0 = none) for the DC prediction, see getPrevDC
+__kernel void huffmanLengthKernel(__global const short* d_pairs, __global const uint* d_pairOffsets, __global const uint* d_pairCounts, __global uint* d_blockBits, __constant uint* huffmanTables, const unsigned int numMCUs, const unsigned int mcusPerRow, const unsigned int restartInterval) {
+    size_t mcu = get_global_id(0);
+    size_t k = get_global_id(1);
+
+    if (mcu >= numMCUs || k >= MCU_BLOCKS) {
+        return;
+    }
+
+    size_t block = getScanBlock(mcu, k, numMCUs, mcusPerRow);
+    int prevDC = getPrevDC(d_pairs, d_pairOffsets, mcu, k, numMCUs, mcusPerRow, restartInterval);
+    __constant uint* dcTable = huffmanTables + (k < MCU_LUMA_BLOCKS ? HUFF_DC_LUMA : HUFF_DC_CHROMA);
+    __constant uint* acTable = huffmanTables + (k < MCU_LUMA_BLOCKS ? HUFF_AC_LUMA : HUFF_AC_CHROMA);
+
+    d_blockBits[mcu * MCU_BLOCKS + k] = encodeBlockBits(d_pairs + 2 * d_pairOffsets[block], d_pairCounts[block], prevDC, dcTable, acTable, 0, 0);
+}
+
+// Restart interval pass: number of bytes of every restart interval (the whole scan is one interval if
+// restartInterval is 0), each interval is padded to a byte boundary. d_blockOffsets and d_blockBits are the
+// exclusive scan of the block lengths and the lengths (scan order). d_intervalBytes has numIntervals + 1 entries,
+// the last one is set to 0, so its exclusive scan gives the byte offset of every interval and the total size.
+__kernel void restartIntervalBytesKernel(__global const uint* d_blockOffsets, __global const uint* d_blockBits, __global uint* d_intervalBytes, const unsigned int numMCUs, const unsigned int restartInterval) {
+    size_t n = get_global_id(0);
+    size_t mcusPerInterval = (restartInterval > 0) ? restartInterval : numMCUs;
+    size_t numIntervals = (numMCUs + mcusPerInterval - 1) / mcusPerInterval;
+
+    if (n > numIntervals) {
+        return;
+    }
+    if (n == numIntervals) {
+        d_intervalBytes[n] = 0;
+        return;
+    }
+
+    size_t first = n * mcusPerInterval * MCU_BLOCKS;
+    size_t last = min((n + 1) * mcusPerInterval, (size_t)numMCUs) * MCU_BLOCKS - 1;
+    d_intervalBytes[n] = (d_blockOffsets[last] + d_blockBits[last] - d_blockOffsets[first] + 7) / 8;
+}
+
+// Huffman scatter pass: write the codes of every block at its bit offset
+// d_blockOffsets is the exclusive scan of the block lengths, d_intervalOffsets the byte offset of every restart
+// interval (see restartIntervalBytesKernel), the last block of an interval pads it to the byte boundary with 1-bits.
+// d_output holds the bit stream in 32 bit words (MSB first) and must be zeroed beforehand
+__kernel void huffmanScatterKernel(__global const short* d_pairs, __global const uint* d_pairOffsets, __global const uint* d_pairCounts, __global const uint* d_blockOffsets, __global const uint* d_intervalOffsets, __global uint* d_output, __constant uint* huffmanTables, const unsigned int numMCUs, const unsigned int mcusPerRow, const unsigned int restartInterval) {
+    size_t mcu = get_global_id(0);
+    size_t k = get_global_id(1);
+
+    if (mcu >= numMCUs || k >= MCU_BLOCKS) {
+        return;
+    }
+
+    size_t block = getScanBlock(mcu, k, numMCUs, mcusPerRow);
+    int prevDC = getPrevDC(d_pairs, d_pairOffsets, mcu, k, numMCUs, mcusPerRow, restartInterval);
+    __constant uint* dcTable = huffmanTables + (k < MCU_LUMA_BLOCKS ? HUFF_DC_LUMA : HUFF_DC_CHROMA);
+    __constant uint* acTable = huffmanTables + (k < MCU_LUMA_BLOCKS ? HUFF_AC_LUMA : HUFF_AC_CHROMA);
+
+    // the offset of the block within its interval, moved to the byte offset of the interval
+    size_t mcusPerInterval = (restartInterval > 0) ? restartInterval : numMCUs;
+    size_t interval = mcu / mcusPerInterval;
+    uint bitOffset = 8 * d_intervalOffsets[interval] + d_blockOffsets[mcu * MCU_BLOCKS + k] - d_blockOffsets[interval * mcusPerInterval * MCU_BLOCKS];
+    uint end = bitOffset + encodeBlockBits(d_pairs + 2 * d_pairOffsets[block], d_pairCounts[block], prevDC, dcTable, acTable, d_output, bitOffset);
+
+    uint pad = (8 - (end & 7)) & 7;
+    if (k == MCU_BLOCKS - 1 && (mcu + 1 == numMCUs || (mcu + 1) % mcusPerInterval == 0) && pad > 0) {
+        atomic_or(&d_output[end >> 5], ((1u << pad) - 1) << (32 - (end & 31) - pad));
+    }
+}
+
+// Huffman histogram pass: count the symbols of the four tables (same layout as huffmanTables)
+// for huffman tables optimized for the image. Every work item counts the RLE pairs of one block (in scan order)
+// into histograms in local memory, which are added to d_histograms (zeroed beforehand) at the end.
+// restartInterval > 0 resets the DC prediction at the start of every restart interval.
+__kernel void huffmanHistogramKernel(__global const short* d_pairs, __global const uint* d_pairOffsets, __global const uint* d_pairCounts, __global uint* d_histograms, __local uint* localHistograms, const unsigned int numMCUs, const unsigned int mcusPerRow, const unsigned int restartInterval) {
+    size_t i = get_global_id(0); // block index in scan order
+    size_t lid = get_local_id(0);
+    size_t lsize = get_local_size(0);
+
+    for (size_t k = lid; k < 4 * 256; k += lsize) {
+        localHistograms[k] = 0;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (i < numMCUs * MCU_BLOCKS) {
+        size_t mcu = i / MCU_BLOCKS;
+        size_t k = i % MCU_BLOCKS;
+        size_t block = getScanBlock(mcu, k, numMCUs, mcusPerRow);
+        __global const short* pairs = d_pairs + 2 * d_pairOffsets[block];
+        uint numPairs = d_pairCounts[block];
+        int prevDC = getPrevDC(d_pairs, d_pairOffsets, mcu, k, numMCUs, mcusPerRow, restartInterval);
+        __local uint* dcHistogram = localHistograms + (k < MCU_LUMA_BLOCKS ? HUFF_DC_LUMA : HUFF_DC_CHROMA);
+        __local uint* acHistogram = localHistograms + (k < MCU_LUMA_BLOCKS ? HUFF_AC_LUMA : HUFF_AC_CHROMA);
+
+        atomic_inc(&dcHistogram[valueCategory(pairs[1] - prevDC)]);
+
+        // the AC pairs are the symbols: (zero run, category), ZRL = (15, 0), EOB = (0, 0)
+        for (uint j = 1; j < numPairs; j++) {
+            atomic_inc(&acHistogram[(pairs[2 * j] << 4) | valueCategory(pairs[2 * j + 1])]);
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (size_t k = lid; k < 4 * 256; k += lsize) {
+        if (localHistograms[k] > 0) {
+            atomic_add(&d_histograms[k], localHistograms[k]);
+        }
+    }
+}
+
+// Exclusive scan (Blelloch) of 2 * local size elements per work group, in place
+// The local size must be a power of two, d_groupSums[group] receives the sum of the group's elements
+__kernel void exclusiveScanKernel(__global uint* d_data, __global uint* d_groupSums, __local uint* temp, const unsigned int n) {
+    size_t lid = get_local_id(0);
+    size_t lsize = get_local_size(0);
+    size_t base = get_group_id(0) * lsize * 2;
+
+    temp[2 * lid] = (base + 2 * lid < n) ? d_data[base + 2 * lid] : 0;
+    temp[2 * lid + 1] = (base + 2 * lid + 1 < n) ? d_data[base + 2 * lid + 1] : 0;
+
+    // up-sweep: build the sums in place
+    size_t offset = 1;
+    for (size_t d = lsize; d > 0; d >>= 1) {
+        barrier(CLK_LOCAL_MEM_FENCE);
+        if (lid < d) {
+            size_t ai = offset * (2 * lid + 1) - 1;
+            size_t bi = offset * (2 * lid + 2) - 1;
+            temp[bi] += temp[ai];
+        }
+        offset *= 2;
+    }
+
+    if (lid == 0) {
+        d_groupSums[get_group_id(0)] = temp[2 * lsize - 1];
+        temp[2 * lsize - 1] = 0;
+    }
+
+    // down-sweep: distribute the partial sums
+    for (size_t d = 1; d < 2 * lsize; d *= 2) {
+        offset >>= 1;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        if (lid < d) {
+            size_t ai = offset * (2 * lid + 1) - 1;
+            size_t bi = offset * (2 * lid + 2) - 1;
+            uint t = temp[ai];
+            temp[ai] = temp[bi];
+            temp[bi] += t;
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (base + 2 * lid < n) {
+        d_data[base + 2 * lid] = temp[2 * lid];
+    }
+    if (base + 2 * lid + 1 < n) {
+        d_data[base + 2 * lid + 1] = temp[2 * lid + 1];
+    }
+}
+
+// Add the scanned group sums to the elements of every scan group (elementsPerGroup elements each)
+__kernel void addGroupOffsetsKernel(__global uint* d_data, __global const uint* d_groupOffsets, const unsigned int n, const unsigned int elementsPerGroup) {
+    size_t i = get_global_id(0);
+
+    if (i >= n) {
+        return;
+    }
+
+    d_data[i] += d_groupOffsets[i / elementsPerGroup];
+}
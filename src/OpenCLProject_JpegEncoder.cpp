@@ -18,18 +18,22 @@
 #include <iostream>
 #include <cmath>
 #include <iomanip>
+#include <algorithm>
 
+#include "huffman.hpp"
 #include "utils.hpp"
+#include "jfif.hpp"
 
 //////////////////////////////////////////////////////////////////////////////
 // CPU implementation
 //////////////////////////////////////////////////////////////////////////////
 
-int JpegEncoderHost(ppm_t imgCPU, CPUTelemetry *cpu_telemetry = NULL) {
+// coefficients (if not NULL) receives the quantized coefficients of the padded image (see coeff_image_t) for the checks of the GPU path
+int JpegEncoderHost(ppm_t imgCPU, const EncoderOptions& options, CPUTelemetry *cpu_telemetry = NULL, std::vector<int16_t> *coefficients = NULL) {
 	
 	std::cout << "\n### CPU Implementation ###" << std::endl;
 	// write the image to a file
-    if (writePPMImage("../data/fruit_copy.ppm", imgCPU.width, imgCPU.height, imgCPU.data) == -1) {
+    if (writePPMImage("../data/fruit_copy.ppm", imgCPU.width, imgCPU.height, imgCPU.data, imgCPU.channels) == -1) {
         std::cout << "Error writing the image" << std::endl;
         return 1;
     }
@@ -39,87 +43,101 @@ int JpegEncoderHost(ppm_t imgCPU, CPUTelemetry *cpu_telemetry = NULL) {
 	// get the attributes of the image structure
     imgCPU2.width = imgCPU.width;
     imgCPU2.height = imgCPU.height;
-    imgCPU2.data = (rgb_pixel_t *)malloc(imgCPU.width * imgCPU.height * sizeof(rgb_pixel_t));
+    imgCPU2.channels = imgCPU.channels;
+    imgCPU2.data = (rgb_pixel_t *)malloc(imgCPU.width * imgCPU.height * imgCPU.channels);
 	// copy the image
-    memcpy(imgCPU2.data, imgCPU.data, imgCPU.width * imgCPU.height * sizeof(rgb_pixel_t));
+    memcpy(imgCPU2.data, imgCPU.data, imgCPU.width * imgCPU.height * imgCPU.channels);
 
     
 	// remove the blue channel from the image - testing
     removeRedChannel(&imgCPU2);
 	// write the image to a file - testing
-    if (writePPMImage("../data/fruitCPU_no_blue.ppm", imgCPU2.width, imgCPU2.height, imgCPU2.data) == -1) {
+    if (writePPMImage("../data/fruitCPU_no_blue.ppm", imgCPU2.width, imgCPU2.height, imgCPU2.data, imgCPU2.channels) == -1) {
         std::cout << "Error writing the image" << std::endl;
         return 1;
     }
 
-	////////////////////////// Color Space Conversion //////////////////////////
-    
-	// perform color space conversion (CSC) and get the CPU time
+	//////////////////////// Color Space Conversion + Chroma Downsampling //////////////////////////
+
+	// fixed-point color space conversion (CSC) into planar Y, Cb and Cr with the chroma downsampling (CDS)
+	// of the Cb and Cr planes (-s, 4:2:0 by default) and the level shift fused into the same pass
+	// grayscale images (PGM input or R == G == B) only get the level shifted Y plane
+	SimdLevel simdLevel = detectSimdLevel();
+	bool grayscale = isGrayscaleImage(&imgCPU);
+	sample_image_t samplesCPU;
+	samplesCPU.width = imgCPU.width;
+	samplesCPU.height = imgCPU.height;
+	samplesCPU.subsamplingX = 1;
+	samplesCPU.subsamplingY = 1;
+	samplesCPU.numComponents = grayscale ? 1 : 3;
+	if (!grayscale) {
+		getChromaSubsamplingFactors(options.chromaSubsampling, &samplesCPU.subsamplingX, &samplesCPU.subsamplingY);
+	}
+	samplesCPU.data = (int8_t *)malloc(getPlaneOffset(samplesCPU.width, samplesCPU.height, samplesCPU.subsamplingX, samplesCPU.subsamplingY, samplesCPU.numComponents) * sizeof(int8_t));
+
+	// perform the fused stage and get the CPU time
 	Core::TimeSpan startTime = Core::getCurrentTime();
-    performCSC(&imgCPU);
+	if (grayscale) {
+		performGrayscaleConversion(&imgCPU, &samplesCPU);
+	} else {
+		performCSCFused(&imgCPU, &samplesCPU, options.chromaSubsampling, simdLevel);
+	}
 	Core::TimeSpan endTime = Core::getCurrentTime();
 	Core::TimeSpan CSCTimeCPU = endTime - startTime;
-	std::cout << "CSC Time CPU: " << CSCTimeCPU.toString() << std::endl;
-	
-	// write the image after CSC to a file
-    if (writePPMImage("../data/fruitCPU_csc.ppm", imgCPU.width, imgCPU.height, imgCPU.data) == -1) {
-        std::cout << "Error writing the image" << std::endl;
-        return 1;
-    }
-	///////////////////////////////////////////////////////////////////////////
-    
-	//////////////////////// Chroma Downsampling ///////////////////////////////
-	
-	// perform chroma downsampling (CDS) and get the CPU time
-	startTime = Core::getCurrentTime();
-    performCDS(&imgCPU);
-	endTime = Core::getCurrentTime();
-	Core::TimeSpan CDSTimeCPU = endTime - startTime;
-	std::cout << "CDS Time CPU: " << CDSTimeCPU.toString() << std::endl;
+	Core::TimeSpan CDSTimeCPU = Core::TimeSpan::fromSeconds(0);
+	if (grayscale) {
+		std::cout << "Level Shifting Time CPU (grayscale, no CSC and CDS): " << CSCTimeCPU.toString() << std::endl;
+	} else {
+		std::cout << "CSC + CDS + Level Shifting Time CPU (" << getChromaSubsamplingName(options.chromaSubsampling) << ", " << getSimdLevelName(simdLevel) << "): " << CSCTimeCPU.toString() << std::endl;
+		std::cout << "CDS Time CPU: fused into the CSC" << std::endl;
+	}
 
-    // write the image to a file
-    if (writePPMImage("../data/fruitCPU_cds.ppm", imgCPU.width, imgCPU.height, imgCPU.data) == -1) {
+	// write the image after CSC and CDS to a file
+	// (into its own image, the input pixels are the mapped input buffer of the GPU path and are only read here)
+	ppm_t imgCPU_cds;
+	imgCPU_cds.width = imgCPU.width;
+	imgCPU_cds.height = imgCPU.height;
+	imgCPU_cds.channels = 3;
+	imgCPU_cds.data = (rgb_pixel_t *)malloc(imgCPU.width * imgCPU.height * sizeof(rgb_pixel_t));
+	copySamplesToUIntImage(&samplesCPU, &imgCPU_cds);
+    if (writePPMImage("../data/fruitCPU_cds.ppm", imgCPU_cds.width, imgCPU_cds.height, imgCPU_cds.data) == -1) {
         std::cout << "Error writing the image" << std::endl;
         return 1;
     }
+	free(imgCPU_cds.data);
 	/////////////////////////////////////////////////////////////////////////////
 
 	//////////////////////// Reverse Padding /////////////////////////////////////
 	
-	// get 8x8 divisible image size
+	// get the image size divisible into whole MCUs (16x16 pixels for 4:2:0)
 	size_t newWidth, newHeight; 
+	getPaddedImageSize(imgCPU.width, imgCPU.height, samplesCPU.subsamplingX, samplesCPU.subsamplingY, &newWidth, &newHeight);
 
-	// Adjust the image size to be divisible by 8
-	if (imgCPU.width % 8 == 0 && imgCPU.height % 8 == 0) {
-		newWidth = imgCPU.width;
-		newHeight = imgCPU.height;
-	} else {
-		getNearest8x8ImageSize(imgCPU.width, imgCPU.height, &newWidth, &newHeight);
-	}
+	sample_image_t samplesCPU3;
+	samplesCPU3.width = newWidth;
+	samplesCPU3.height = newHeight;
+	samplesCPU3.subsamplingX = samplesCPU.subsamplingX;
+	samplesCPU3.subsamplingY = samplesCPU.subsamplingY;
+	samplesCPU3.numComponents = samplesCPU.numComponents;
+	samplesCPU3.data = (int8_t *)malloc(getPlaneOffset(newWidth, newHeight, samplesCPU3.subsamplingX, samplesCPU3.subsamplingY, samplesCPU3.numComponents) * sizeof(int8_t));
+
+	// copy the samples to the new image with reverse padding
+	startTime = Core::getCurrentTime();
+	copyToLargerSampleImage(&samplesCPU, &samplesCPU3);
+	endTime = Core::getCurrentTime();
+	Core::TimeSpan TotalCopyTimeCPU = endTime - startTime;
+	std::cout << "Total Copy Time CPU: " << TotalCopyTimeCPU.toString() << std::endl;
 
 	ppm_t imgCPU3;
 	
 	// copy the image
 	imgCPU3.width = newWidth;
 	imgCPU3.height = newHeight;
+	imgCPU3.channels = 3;
 	imgCPU3.data = (rgb_pixel_t *)malloc(newWidth * newHeight * sizeof(rgb_pixel_t));
 
-	// copy the image to the new image with padding
-	startTime = Core::getCurrentTime();
-	copyToLargerImage(&imgCPU, &imgCPU3);
-	endTime = Core::getCurrentTime();
-	Core::TimeSpan copyTimeCPU = endTime - startTime;
-
-	// write the image to a file
-	if (writePPMImage("../data/fruitCPU_copy_larger.ppm", imgCPU3.width, imgCPU3.height, imgCPU3.data) == -1) {
-		std::cout << "Error writing the image" << std::endl;
-		return 1;
-	}
-
-	// add reverse padding to the image
-	addReversedPadding(&imgCPU3, imgCPU.width, imgCPU.height);
-
 	// write the image to a file
+	copySamplesToUIntImage(&samplesCPU3, &imgCPU3);
 	if (writePPMImage("../data/fruitCPU_copy_larger_padded.ppm", imgCPU3.width, imgCPU3.height, imgCPU3.data) == -1) {
 		std::cout << "Error writing the image" << std::endl;
 		return 1;
@@ -128,105 +146,100 @@ int JpegEncoderHost(ppm_t imgCPU, CPUTelemetry *cpu_telemetry = NULL) {
  	/////////////////////////////////////////////////////////////////////////////////////////////////
 
 	///////////////////////////////// Level Shifting /////////////////////////////////////////////////
-	
-	ppm_d_t imgCPU_d;
-	// copy the image
-	imgCPU_d.width = imgCPU3.width;
-	imgCPU_d.height = imgCPU3.height;
-	imgCPU_d.data = (rgb_pixel_d_t *)malloc(imgCPU3.width * imgCPU3.height * sizeof(rgb_pixel_d_t));
-
-	startTime = Core::getCurrentTime();
-	copyUIntToDoubleImage(&imgCPU3, &imgCPU_d);
-	endTime = Core::getCurrentTime();
 
-	Core::TimeSpan copyTimeCPU2 = endTime - startTime;
-	Core::TimeSpan TotalCopyTimeCPU = copyTimeCPU + copyTimeCPU2;
-	std::cout << "Total Copy Time CPU: " << TotalCopyTimeCPU.toString() << std::endl;
-
-	startTime = Core::getCurrentTime();
-	substractfromAll(&imgCPU_d, 128.0);
-	endTime = Core::getCurrentTime();
+	Core::TimeSpan levelShiftingCPU = Core::TimeSpan::fromSeconds(0);
+	std::cout << "Level Shifting Time CPU: folded into the CSC" << std::endl;
 
-	Core::TimeSpan levelShiftingCPU = endTime - startTime;
-	std::cout << "Level Shifting Time CPU: " << levelShiftingCPU.toString() << std::endl;
+	free(samplesCPU.data);
 
 	/////////////////////////////////////////////////////////////////////////////////////////////////
 
 	//////////////////////////////////// Discrete Cosine Transform ///////////////////////////////////
 
+	// quantized coefficients (16 bit, block after block) from the quantization to the entropy coding,
+	// with the geometry of the padded sample planes
+	coeff_image_t coeffsCPU;
+	coeffsCPU.width = samplesCPU3.width;
+	coeffsCPU.height = samplesCPU3.height;
+	coeffsCPU.subsamplingX = samplesCPU3.subsamplingX;
+	coeffsCPU.subsamplingY = samplesCPU3.subsamplingY;
+	coeffsCPU.numComponents = samplesCPU3.numComponents;
+	coeffsCPU.data = (int16_t *)malloc(getPlaneOffset(coeffsCPU.width, coeffsCPU.height, coeffsCPU.subsamplingX, coeffsCPU.subsamplingY, coeffsCPU.numComponents) * sizeof(int16_t));
+
+	// every DCT method reads the blocks from the sample planes and quantizes them in the same pass,
+	// the time is reported as DCT time
 	startTime = Core::getCurrentTime();
-	performDCT(&imgCPU_d);
+	performDCTQuantizationPlanar(&samplesCPU3, quant_mat_lum, quant_mat_chrom, options.dctMethod, simdLevel, &coeffsCPU);
 	endTime = Core::getCurrentTime();
 
 	Core::TimeSpan DCTTimeCPU = endTime - startTime;
-	std::cout << "DCT Time CPU: " << DCTTimeCPU.toString() << std::endl;
+	if (options.dctMethod == DCT_SIMD || options.dctMethod == DCT_INT) {
+		std::cout << "DCT + Quantization Time CPU (" << getDCTMethodName(options.dctMethod) << ", " << getSimdLevelName(simdLevel) << "): " << DCTTimeCPU.toString() << std::endl;
+	} else {
+		std::cout << "DCT + Quantization Time CPU (" << getDCTMethodName(options.dctMethod) << "): " << DCTTimeCPU.toString() << std::endl;
+	}
+
+	free(samplesCPU3.data);
 
 	/////////////////////////////////////////////////////////////////////////////////////////////////
 
 	//////////////////////////////////// Quantization ////////////////////////////////////////////////
 
-	startTime = Core::getCurrentTime();
-	performQuantization(&imgCPU_d, quant_mat_lum, quant_mat_chrom);
-	endTime = Core::getCurrentTime();
-
-	Core::TimeSpan QuantTimeCPU = endTime - startTime;
-	std::cout << "Quantization Time CPU: " << QuantTimeCPU.toString() << std::endl;
+	Core::TimeSpan QuantTimeCPU = Core::TimeSpan::fromSeconds(0);
+	std::cout << "Quantization Time CPU: fused into the DCT" << std::endl;
 
 	/////////////////////////////////////////////////////////////////////////////////////////////////
 
 
-	//////////////////////////////////// ZigZag Scanning ////////////////////////////////////////////
+	//////////////////////////////// Entropy Coding (ZigZag + RLE + Huffman) //////////////////////////
 
-	// initialize an linear array with the size of the image
-	float *image = new float[imgCPU_d.width * imgCPU_d.height * 3];
+	// bit writer for the entropy-coded data
+	BitWriter scanData(coeffsCPU.width * coeffsCPU.height);
+	// restart intervals or chunks of MCU rows are coded in parallel on a thread pool
+	ThreadPool pool(options.numThreads);
 
-	// number of rows of 2D array = (total image pixels / 64) * 3
-	// number of columns of 2D array = 64
-	unsigned int rows = (imgCPU_d.width * imgCPU_d.height) / 64 * 3;
-	unsigned int rowsperchannel = (imgCPU_d.width * imgCPU_d.height) / 64;
-	
-	// make two 2D arrays to store the linear and zigzag arrays
-	// where each row is a linearized MCU 
-	int linear_arr[rows][64];
-	int zigzag_arr[rows][64];
+	// optional first pass: symbol histograms and huffman tables optimized for this image
+	HuffmanTableSet huffmanTables = getStandardHuffmanTables();
+	Core::TimeSpan HuffmanTablesTimeCPU = Core::TimeSpan::fromSeconds(0);
+	if (options.optimizeHuffman) {
+		uint32_t histograms[4][256];
+		startTime = Core::getCurrentTime();
+		gatherHuffmanHistograms(&coeffsCPU, options.restartInterval, &pool, histograms);
+		buildOptimalHuffmanTables(histograms, &huffmanTables);
+		endTime = Core::getCurrentTime();
 
-	startTime = Core::getCurrentTime();
-	everyMCUisnow2DArray(&imgCPU_d, linear_arr);
-
-	// perform zigzag on the 2D array
-	performZigZag(linear_arr, zigzag_arr, rows);
-	endTime = Core::getCurrentTime();
-
-	Core::TimeSpan ZigZagTimeCPU = endTime - startTime;
-	std::cout << "ZigZag Time CPU: " << ZigZagTimeCPU.toString() << std::endl;
-
-	/////////////////////////////////////////////////////////////////////////////////////////////////
-
-	//////////////////////////////////// RLE Encoding ///////////////////////////////////////////////
+		HuffmanTablesTimeCPU = endTime - startTime;
+		std::cout << "Huffman Table Optimization Time CPU: " << HuffmanTablesTimeCPU.toString() << std::endl;
+	}
 
-	// 2D vector to store the rle values for all channels
-	std::vector<std::vector<int>> rle;
-	
+	// zigzag scanning, run length encoding and huffman encoding in a single pass over every block
 	startTime = Core::getCurrentTime();
-
-	// for all channels
-	performRLE(zigzag_arr, rle, rows);
+	performEntropyCoding(&coeffsCPU, scanData, options.restartInterval, &pool, &huffmanTables);
 	endTime = Core::getCurrentTime();
 
-	Core::TimeSpan RLETimeCPU = endTime - startTime;
-	std::cout << "RLE Time CPU: " << RLETimeCPU.toString() << std::endl;
+	Core::TimeSpan EntropyCodingTimeCPU = endTime - startTime + HuffmanTablesTimeCPU;
+	std::cout << "Entropy Coding (ZigZag + RLE + Huffman) Time CPU: " << EntropyCodingTimeCPU.toString() << std::endl;
+
+	if (coefficients != NULL) {
+		coefficients->assign(coeffsCPU.data, coeffsCPU.data + getPlaneOffset(coeffsCPU.width, coeffsCPU.height, coeffsCPU.subsamplingX, coeffsCPU.subsamplingY, coeffsCPU.numComponents));
+	}
+	free(coeffsCPU.data);
 
 	/////////////////////////////////////////////////////////////////////////////////////////////////
 
-	//////////////////////////////////// Huffman Encoding ////////////////////////////////////////////
+	//////////////////////////////////// JFIF File Output ////////////////////////////////////////////
 
-	// huffman encoding
-	startTime = Core::getCurrentTime();
-	std::string scanData = HuffmanEncoder(zigzag_arr, rle, rowsperchannel);
-	endTime = Core::getCurrentTime();
+	JFIFHeader jfifHeader = { imgCPU.width, imgCPU.height, quant_mat_lum, quant_mat_chrom, coeffsCPU.numComponents, coeffsCPU.subsamplingX, coeffsCPU.subsamplingY, options.restartInterval, &huffmanTables };
+
+	// the output buffer is sized for the headers, the entropy-coded data and EOI
+	std::vector<uint8_t> jpegCPU(getJFIFFileSize(jfifHeader, scanData.size()));
+	size_t jpegSizeCPU = writeJFIF(jpegCPU.data(), jpegCPU.size(), jfifHeader, scanData.data(), scanData.size());
+	std::cout << "JPEG file size CPU: " << jpegSizeCPU << " bytes" << std::endl;
 
-	Core::TimeSpan HuffmanTimeCPU = endTime - startTime;
-	std::cout << "Huffman Time CPU: " << HuffmanTimeCPU.toString() << std::endl;
+	if (writeJPEGImage("../data/fruitCPU.jpg", jpegCPU.data(), jpegSizeCPU) == -1) {
+		std::cout << "Error writing the image" << std::endl;
+		return 1;
+	}
 
 	/////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -237,22 +250,202 @@ int JpegEncoderHost(ppm_t imgCPU, CPUTelemetry *cpu_telemetry = NULL) {
 		cpu_telemetry->levelShiftTime = static_cast<double>(levelShiftingCPU.getMicroseconds());
 		cpu_telemetry->DCTTime = static_cast<double>(DCTTimeCPU.getMicroseconds());
 		cpu_telemetry->QuantTime = static_cast<double>(QuantTimeCPU.getMicroseconds());
-		cpu_telemetry->zigZagTime = static_cast<double>(ZigZagTimeCPU.getMicroseconds());
-		cpu_telemetry->RLETime = static_cast<double>(RLETimeCPU.getMicroseconds());
-		cpu_telemetry->HuffmanTime = static_cast<double>(HuffmanTimeCPU.getMicroseconds());
+		cpu_telemetry->entropyCodingTime = static_cast<double>(EntropyCodingTimeCPU.getMicroseconds());
 		cpu_telemetry->TotalCopyTime = static_cast<double>(TotalCopyTimeCPU.getMicroseconds());
 	}
 
 	// print total time
-	std::cout << "Total Time CPU: " << (CSCTimeCPU + CDSTimeCPU + TotalCopyTimeCPU + levelShiftingCPU + DCTTimeCPU + QuantTimeCPU + ZigZagTimeCPU + RLETimeCPU + HuffmanTimeCPU).toString() << std::endl;
+	std::cout << "Total Time CPU: " << (CSCTimeCPU + CDSTimeCPU + TotalCopyTimeCPU + levelShiftingCPU + DCTTimeCPU + QuantTimeCPU + EntropyCodingTimeCPU).toString() << std::endl;
 
 	return 0;
 }
 
+//////////////////////////////////////////////////////////////////////////////
+// GPU helper functions
+//////////////////////////////////////////////////////////////////////////////
+
+// Function to round a global size up to a multiple of the work group size
+size_t roundUpToMultiple(size_t n, size_t multiple) {
+	return (n + multiple - 1) / multiple * multiple;
+}
+
+// device buffer with pinned host memory (CL_MEM_ALLOC_HOST_PTR) that is mapped while the host fills it
+struct MappedBuffer {
+	cl::Context *context;
+	cl::CommandQueue *queue;
+	cl_ulong maxAllocSize; // CL_DEVICE_MAX_MEM_ALLOC_SIZE of the device
+	cl::Buffer buffer;
+};
+
+typedef struct MappedBuffer mapped_buffer_t;
+
+// Function to allocate the pixels of the input image in a mapped device buffer (allocator of readPPMImageInto):
+// the file is read straight into memory the device can access, without a copy on devices that share the host
+// memory (integrated GPUs, CPU devices) and with a DMA transfer from pinned memory on discrete GPUs
+rgb_pixel_t *allocateMappedPixels(size_t width, size_t height, unsigned int channels, void *context) {
+	mapped_buffer_t *mapped = (mapped_buffer_t *)context;
+	size_t size = width * height * channels;
+	if (size > mapped->maxAllocSize) {
+		std::cerr << "The image needs a buffer of " << size << " bytes, the device allows at most " << mapped->maxAllocSize << " bytes" << std::endl;
+		return NULL;
+	}
+	mapped->buffer = cl::Buffer(*mapped->context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, size);
+	return (rgb_pixel_t *)mapped->queue->enqueueMapBuffer(mapped->buffer, CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION, 0, size);
+}
+
+// Function to run an in-place exclusive scan of n cl_uint values on the device
+// Every work group scans 2 * wgSize elements, the group sums are scanned recursively and added back
+// The first kernel waits for waitEvents, the events of all launched kernels are appended to events (the last one completes the scan)
+void enqueueExclusiveScan(cl::Context& context, cl::CommandQueue& queue, cl::Kernel& scanKernel, cl::Kernel& addKernel, cl::Buffer& d_data, size_t n, size_t wgSize, const std::vector<cl::Event>* waitEvents, std::vector<cl::Event>& events) {
+	size_t elementsPerGroup = 2 * wgSize;
+	size_t numGroups = (n + elementsPerGroup - 1) / elementsPerGroup;
+	cl::Buffer d_groupSums = cl::Buffer(context, CL_MEM_READ_WRITE, numGroups * sizeof (cl_uint));
+
+	cl::Event scanEvent;
+	scanKernel.setArg<cl::Buffer>(0, d_data);
+	scanKernel.setArg<cl::Buffer>(1, d_groupSums);
+	scanKernel.setArg(2, cl::Local(elementsPerGroup * sizeof (cl_uint)));
+	scanKernel.setArg<cl_uint>(3, (cl_uint)n);
+	queue.enqueueNDRangeKernel(scanKernel, cl::NullRange, cl::NDRange(numGroups * wgSize), cl::NDRange(wgSize), waitEvents, &scanEvent);
+	events.push_back(scanEvent);
+
+	if (numGroups > 1) {
+		// scan the group sums and add them to every element of the group
+		std::vector<cl::Event> scanDone(1, scanEvent);
+		enqueueExclusiveScan(context, queue, scanKernel, addKernel, d_groupSums, numGroups, wgSize, &scanDone, events);
+
+		cl::Event addEvent;
+		std::vector<cl::Event> groupSumsDone(1, events.back());
+		addKernel.setArg<cl::Buffer>(0, d_data);
+		addKernel.setArg<cl::Buffer>(1, d_groupSums);
+		addKernel.setArg<cl_uint>(2, (cl_uint)n);
+		addKernel.setArg<cl_uint>(3, (cl_uint)elementsPerGroup);
+		queue.enqueueNDRangeKernel(addKernel, cl::NullRange, cl::NDRange(numGroups * elementsPerGroup), cl::NDRange(wgSize), &groupSumsDone, &addEvent);
+		events.push_back(addEvent);
+	}
+}
+
+// Function to check the fused MCU kernel against the per-stage kernels on a small test image
+// The image is smaller than an MCU in both directions, so most of the MCU is mirror padding.
+// Both pipelines read the same pixels and have to give the same quantized coefficients in zigzag order
+// (bit-identical with the integer DCT, at most 1 apart with the float DCTs, which round differently).
+// All 2-D kernels run with 8x8 work groups, which divide the padded image.
+bool checkFusedPipelineSmallImage(cl::Context& context, cl::CommandQueue& queue, cl::Program& program, cl::Buffer& d_quantLum, cl::Buffer& d_quantChrom, DCTMethod dctMethod, unsigned int numComponents, unsigned int subsamplingX, unsigned int subsamplingY) {
+	const size_t width = 5;
+	const size_t height = 3;
+	size_t paddedWidth, paddedHeight;
+	getPaddedImageSize(width, height, subsamplingX, subsamplingY, &paddedWidth, &paddedHeight);
+	size_t numSamples = getPlaneOffset(paddedWidth, paddedHeight, subsamplingX, subsamplingY, numComponents);
+	bool integerDCT = (dctMethod == DCT_INT);
+
+	// a color pattern (one gray value per pixel for grayscale kernels) with a different value in every pixel
+	std::vector<uint8_t> pixels(width * height * numComponents);
+	for (size_t i = 0; i < width * height; ++i) {
+		pixels[numComponents * i] = (uint8_t)(37 * i + 11);
+		if (numComponents == 3) {
+			pixels[3 * i + 1] = (uint8_t)(255 - 23 * i);
+			pixels[3 * i + 2] = (uint8_t)(91 * i);
+		}
+	}
+	cl::Buffer d_pixels = cl::Buffer(context, CL_MEM_READ_ONLY, pixels.size());
+	queue.enqueueWriteBuffer(d_pixels, true, 0, pixels.size(), pixels.data());
+
+	std::vector<cl_float> hDCTmatrix(64);
+	getDCTMatrix(hDCTmatrix.data());
+	cl::Buffer dDCTmatrix = cl::Buffer(context, CL_MEM_READ_ONLY, 64 * sizeof (cl_float));
+	queue.enqueueWriteBuffer(dDCTmatrix, true, 0, 64 * sizeof (cl_float), hDCTmatrix.data());
+
+	// fused kernel, one work group per MCU
+	unsigned int mcuBlocks = subsamplingX * subsamplingY + numComponents - 1;
+	cl::Buffer d_fusedOutput = cl::Buffer(context, CL_MEM_READ_WRITE, numSamples * sizeof (cl_short));
+	cl::Kernel encodeMCUKernel(program, "encodeMCUKernel");
+	encodeMCUKernel.setArg<cl::Buffer>(0, d_pixels);
+	encodeMCUKernel.setArg<cl::Buffer>(1, d_fusedOutput);
+	encodeMCUKernel.setArg<cl::Buffer>(2, dDCTmatrix);
+	encodeMCUKernel.setArg<cl::Buffer>(3, d_quantLum);
+	encodeMCUKernel.setArg<cl::Buffer>(4, d_quantChrom);
+	encodeMCUKernel.setArg(5, cl::Local(mcuBlocks * 64 * sizeof (cl_float)));
+	encodeMCUKernel.setArg(6, cl::Local(mcuBlocks * 64 * sizeof (cl_float)));
+	encodeMCUKernel.setArg<cl_uint>(7, (cl_uint)integerDCT);
+	encodeMCUKernel.setArg<cl_uint>(8, (cl_uint)width);
+	encodeMCUKernel.setArg<cl_uint>(9, (cl_uint)height);
+	encodeMCUKernel.setArg<cl_uint>(10, (cl_uint)paddedWidth);
+	encodeMCUKernel.setArg<cl_uint>(11, (cl_uint)paddedHeight);
+	queue.enqueueNDRangeKernel(encodeMCUKernel, cl::NullRange, cl::NDRange(paddedWidth / subsamplingX, paddedHeight / subsamplingY), cl::NDRange(8, 8));
+
+	// per-stage kernels: color conversion, DCT (integer or tiled), quantization and zigzag scan
+	cl::Buffer d_samples = cl::Buffer(context, CL_MEM_READ_WRITE, numSamples * sizeof (cl_float));
+	cl::Kernel colorConversionSubsamplingKernel(program, "colorConversionSubsamplingKernel");
+	colorConversionSubsamplingKernel.setArg<cl::Buffer>(0, d_pixels);
+	colorConversionSubsamplingKernel.setArg<cl::Buffer>(1, d_samples);
+	colorConversionSubsamplingKernel.setArg<cl_uint>(2, (cl_uint)width);
+	colorConversionSubsamplingKernel.setArg<cl_uint>(3, (cl_uint)height);
+	colorConversionSubsamplingKernel.setArg<cl_uint>(4, (cl_uint)paddedWidth);
+	colorConversionSubsamplingKernel.setArg<cl_uint>(5, (cl_uint)paddedHeight);
+	queue.enqueueNDRangeKernel(colorConversionSubsamplingKernel, cl::NullRange, cl::NDRange(getPlaneSize(paddedWidth, subsamplingX, 1), getPlaneSize(paddedHeight, subsamplingY, 1)), cl::NDRange(8, 8));
+
+	cl::Buffer d_coefficients = cl::Buffer(context, CL_MEM_READ_WRITE, numSamples * sizeof (cl_int));
+	cl::Kernel quantizationKernel;
+	if (integerDCT) {
+		cl::Kernel DCTIntKernel(program, "DCTIntKernel");
+		DCTIntKernel.setArg<cl::Buffer>(0, d_samples);
+		DCTIntKernel.setArg<cl::Buffer>(1, d_coefficients);
+		DCTIntKernel.setArg<cl_uint>(2, (cl_uint)paddedWidth);
+		DCTIntKernel.setArg<cl_uint>(3, (cl_uint)paddedHeight);
+		queue.enqueueNDRangeKernel(DCTIntKernel, cl::NullRange, cl::NDRange(paddedWidth / 8, paddedHeight / 8, numComponents), cl::NullRange);
+		quantizationKernel = cl::Kernel(program, "quantizationIntKernel");
+	} else {
+		cl::Kernel DCTTiledKernel(program, "DCTTiledKernel");
+		DCTTiledKernel.setArg<cl::Buffer>(0, d_samples);
+		DCTTiledKernel.setArg<cl::Buffer>(1, d_coefficients);
+		DCTTiledKernel.setArg<cl::Buffer>(2, dDCTmatrix);
+		DCTTiledKernel.setArg(3, cl::Local(numComponents * 64 * sizeof (cl_float)));
+		DCTTiledKernel.setArg(4, cl::Local(numComponents * 64 * sizeof (cl_float)));
+		DCTTiledKernel.setArg<cl_uint>(5, (cl_uint)paddedWidth);
+		DCTTiledKernel.setArg<cl_uint>(6, (cl_uint)paddedHeight);
+		queue.enqueueNDRangeKernel(DCTTiledKernel, cl::NullRange, cl::NDRange(paddedWidth, paddedHeight), cl::NDRange(8, 8));
+		quantizationKernel = cl::Kernel(program, "quantizationKernel");
+	}
+	cl::Buffer d_quantized = cl::Buffer(context, CL_MEM_READ_WRITE, numSamples * sizeof (cl_short));
+	quantizationKernel.setArg<cl::Buffer>(0, d_coefficients);
+	quantizationKernel.setArg<cl::Buffer>(1, d_quantized);
+	quantizationKernel.setArg<cl::Buffer>(2, d_quantLum);
+	quantizationKernel.setArg<cl::Buffer>(3, d_quantChrom);
+	quantizationKernel.setArg<cl_uint>(4, (cl_uint)paddedWidth);
+	quantizationKernel.setArg<cl_uint>(5, (cl_uint)paddedHeight);
+	queue.enqueueNDRangeKernel(quantizationKernel, cl::NullRange, cl::NDRange(paddedWidth, paddedHeight), cl::NDRange(8, 8));
+
+	cl::Buffer d_stagesOutput = cl::Buffer(context, CL_MEM_READ_WRITE, numSamples * sizeof (cl_short));
+	cl::Kernel zigzagKernel(program, "zigzagKernel");
+	zigzagKernel.setArg<cl::Buffer>(0, d_quantized);
+	zigzagKernel.setArg<cl::Buffer>(1, d_stagesOutput);
+	zigzagKernel.setArg<cl_uint>(2, (cl_uint)(numSamples / 64));
+	queue.enqueueNDRangeKernel(zigzagKernel, cl::NullRange, cl::NDRange(numSamples / 64, 64), cl::NullRange);
+
+	// the queue is in order, the blocking reads wait for both pipelines
+	std::vector<cl_short> fusedOutput(numSamples);
+	std::vector<cl_short> stagesOutput(numSamples);
+	queue.enqueueReadBuffer(d_fusedOutput, true, 0, numSamples * sizeof (cl_short), fusedOutput.data());
+	queue.enqueueReadBuffer(d_stagesOutput, true, 0, numSamples * sizeof (cl_short), stagesOutput.data());
+
+	int maxDifference = 0;
+	for (size_t i = 0; i < numSamples; ++i) {
+		maxDifference = std::max(maxDifference, std::abs(fusedOutput[i] - stagesOutput[i]));
+	}
+	std::cout << "Fused MCU kernel check (" << width << "x" << height << " image): max. coefficient difference to the per-stage kernels " << maxDifference << std::endl;
+	return maxDifference <= (integerDCT ? 0 : 1);
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////
 // Main function
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 int main(int argc, char** argv) {
+
+	// parse the encoder options
+	EncoderOptions options;
+	if (parseEncoderOptions(argc, argv, &options) == -1) {
+		return 1;
+	}
 	
 	// Create a context
 	//cl::Context context(CL_DEVICE_TYPE_GPU);
@@ -262,18 +455,25 @@ int main(int argc, char** argv) {
 		std::cerr << "No platforms found" << std::endl;
 		return 1;
 	}
-	// Select the platform
-	int platformId = 0;
+	// Select the platform: AMD if available, otherwise the first one with a device of the requested type
+	int platformId = -1;
 	for (size_t i = 0; i < platforms.size(); i++) {
-		if (platforms[i].getInfo<CL_PLATFORM_NAME>() == "AMD Accelerated Parallel Processing") {
+		std::vector<cl::Device> platformDevices;
+		if (platforms[i].getDevices(options.deviceType, &platformDevices) != CL_SUCCESS || platformDevices.empty()) {
+			continue;
+		}
+		if (platformId == -1 || platforms[i].getInfo<CL_PLATFORM_NAME>() == "AMD Accelerated Parallel Processing") {
 			platformId = i;
-			break;
 		}
 	}
-	// Create a context with the GPU device
+	if (platformId == -1) {
+		std::cerr << "No platform with a device of the requested type found" << std::endl;
+		return 1;
+	}
+	// Create a context with the device (GPU by default)
 	cl_context_properties prop[4] = { CL_CONTEXT_PLATFORM, (cl_context_properties) platforms[platformId] (), 0, 0 };
 	std::cout << "Using platform '" << platforms[platformId].getInfo<CL_PLATFORM_NAME>() << "' from '" << platforms[platformId].getInfo<CL_PLATFORM_VENDOR>() << "'" << std::endl;
-	cl::Context context(CL_DEVICE_TYPE_GPU, prop);
+	cl::Context context(options.deviceType, prop);
 
 	// Get the first device of the context
 	std::cout << "Context has " << context.getInfo<CL_CONTEXT_DEVICES>().size() << " devices" << std::endl;
@@ -285,211 +485,118 @@ int main(int argc, char** argv) {
 	// Create a command queue
 	cl::CommandQueue queue(context, device, CL_QUEUE_PROFILING_ENABLE);
 
+	// read the ppm image into the mapped input buffer of the GPU path, the CPU path reads it from there as well
+	ppm_t imgCPU;
+	mapped_buffer_t mappedInput = { &context, &queue, device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>(), cl::Buffer() };
+
+	if (readPPMImageInto(options.inputFile, &imgCPU.width, &imgCPU.height, &imgCPU.data, &imgCPU.channels, allocateMappedPixels, &mappedInput) == -1) {
+		std::cout << "Error reading the image" << std::endl;
+		return 1;
+	}
+	// the frame header stores width and height in 16 bits
+	if (imgCPU.width > JPEG_MAX_DIMENSION || imgCPU.height > JPEG_MAX_DIMENSION) {
+		std::cerr << "Image size " << imgCPU.width << "x" << imgCPU.height << " exceeds the JPEG maximum of " << JPEG_MAX_DIMENSION << " pixels per dimension" << std::endl;
+		return 1;
+	}
+	cl::Buffer d_input = mappedInput.buffer;
+
+	// grayscale images (PGM input or R == G == B) are encoded with the Y component only:
+	// no color conversion and no chroma subsampling. PGM images stay at one byte per pixel, gray PPM images
+	// are packed to the same layout, which the grayscale kernels read
+	bool grayscale = isGrayscaleImage(&imgCPU);
+	if (grayscale) {
+		packGrayscaleImage(&imgCPU);
+	}
+	unsigned int numComponents = grayscale ? 1 : 3;
+
 	// Load the source code
 	cl::Program program = OpenCL::loadProgramSource(context, "../src/OpenCLProject_JpegEncoder.cl");
+	// chroma subsampling of the GPU path, the kernels are compiled for these sampling factors and components
+	unsigned int subsamplingX = 1, subsamplingY = 1;
+	if (!grayscale) {
+		getChromaSubsamplingFactors(options.chromaSubsampling, &subsamplingX, &subsamplingY);
+	}
+	std::ostringstream buildOptions;
+	buildOptions << "-D CHROMA_SUBSAMPLING_X=" << subsamplingX << " -D CHROMA_SUBSAMPLING_Y=" << subsamplingY << " -D NUM_COMPONENTS=" << numComponents;
 	// Compile the source code. This is similar to program.build(devices) but will print more detailed error messages
-	OpenCL::buildProgram(program, devices);
-	
-	// Declare some values
-	std::size_t wgSizeX = 16; // Number of work items per work group in X direction
-	std::size_t wgSizeY = 16; // Number of work items per work group in Y direction
-	std::size_t countX = wgSizeX * 16; // Overall number of work items in X direction = Number of elements in X direction
-	std::size_t countY = wgSizeY * 16;
-	countX *= 3; // image channels
-	std::size_t count = countX * countY; // Overall number of elements
-	std::size_t size = count * sizeof (cl_uint); // Size of data in bytes
-
-	// Allocate space for output data from CPU and GPU on the host
-	std::vector<cl_uint> h_input (count);
-	std::vector<cl_uint> h_outputGpu (count);
-
-	// Allocate space for input and output data on the device
-	cl::Buffer d_input = cl::Buffer(context, CL_MEM_READ_WRITE, size);
-	cl::Buffer d_output = cl::Buffer(context, CL_MEM_READ_WRITE, size);
-
-	// Initialize memory to 0xff (useful for debugging because otherwise GPU memory will contain information from last execution)
-	memset(h_input.data(), 255, size);
-	memset(h_outputGpu.data(), 255, size);
-
-	queue.enqueueWriteBuffer(d_input, true, 0, size, h_input.data());
-	queue.enqueueWriteBuffer(d_output, true, 0, size, h_outputGpu.data());
-
-	// read the ppm image
-    ppm_t imgCPU;
+	OpenCL::buildProgram(program, devices, buildOptions.str());
 	
-	if (readPPMImage("../data/fruit.ppm", &imgCPU.width, &imgCPU.height, &imgCPU.data) == -1) {
-		std::cout << "Error reading the image" << std::endl;
+	// Work group size of the 2-D kernels: 16x16 if the device and every kernel launched with it allow it, otherwise 8x8
+	// (the tiled DCT and the fused kernel need a multiple of 8 in both dimensions). The register and local memory
+	// use of a kernel can limit its work groups below the device maximum (CL_KERNEL_WORK_GROUP_SIZE).
+	std::size_t maxWorkGroupSize = device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+	std::size_t maxWorkGroupSize2D = maxWorkGroupSize;
+	const char *kernels2D[] = { "colorConversionSubsamplingKernel", "DCTKernel", "DCTTiledKernel", "quantizationKernel", "quantizationIntKernel", "zigzagKernel" };
+	for (const char *name : kernels2D) {
+		cl::Kernel kernel(program, name);
+		maxWorkGroupSize2D = std::min(maxWorkGroupSize2D, kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+	}
+	if (maxWorkGroupSize2D < 64) {
+		std::cerr << "The device and kernels support only " << maxWorkGroupSize2D << " work items per work group, at least 64 (8x8) are needed" << std::endl;
 		return 1;
 	}
+	std::size_t wgSizeX = (maxWorkGroupSize2D >= 256) ? 16 : 8; // Number of work items per work group in X direction
+	std::size_t wgSizeY = wgSizeX; // Number of work items per work group in Y direction
 
-	copyImageToVector(&imgCPU, h_input);
-
-	// create an instance of cpu_telemetry
-	CPUTelemetry cpu_telemetry;
-	// perform the JPEG encoding on the CPU
-	JpegEncoderHost(imgCPU, &cpu_telemetry);
-
-	// Copy input data to device
-	queue.enqueueWriteBuffer(d_input, true, 0, size, h_input.data(), NULL, NULL);
-
-	std::cout << "\n### GPU Implementation ###" << std::endl;
-	//////////////////////////////////// Color Space Conversion (GPU) ///////////////////////////////////////
-
-	cl::Event colorConversionEvent;
-	
-	// create a kernel object for color conversion
-	cl::Kernel colorConversionKernel(program, "colorConversionKernel");
-
-	// Set kernel parameters
-	colorConversionKernel.setArg<cl::Buffer>(0, d_input);
-	colorConversionKernel.setArg<cl::Buffer>(1, d_output);
-	
-	// convert size_t to unsigned int
-	colorConversionKernel.setArg<cl_uint>(2, (cl_uint)imgCPU.width);
-	colorConversionKernel.setArg<cl_uint>(3, (cl_uint)imgCPU.height);
-
-	// Launch kernel on the compute device
-	queue.enqueueNDRangeKernel(colorConversionKernel, cl::NullRange, cl::NDRange(countX, countY), cl::NDRange(wgSizeX, wgSizeY), NULL, &colorConversionEvent);
-	
-	// Copy output data back to host
-	queue.enqueueReadBuffer(d_output, true, 0, size, h_outputGpu.data(), NULL, NULL);
-
-	// Wait for all commands to complete
-	queue.finish();
-
-	// Print performance data
-	Core::TimeSpan colorConversionTimeGPU = OpenCL::getElapsedTime(colorConversionEvent);
-	std::cout << "Color conversion time (GPU): " << colorConversionTimeGPU.toString() << std::endl;
-
-	////////////////////////////////////////////////////////////////////////////////////////////////////////
-
-	//////////////////////////////////// Chroma Subsampling (GPU) and Padding //////////////////////////////
-
-	/* Copy to larger image */
-	// get 8x8 divisible image size
+	// get the image size divisible into whole MCUs (16x16 pixels for 4:2:0)
 	size_t newWidth, newHeight;
-	if (imgCPU.width % 8 == 0 && imgCPU.height % 8 == 0) {
-		newWidth = imgCPU.width;
-		newHeight = imgCPU.height;
-	} else {
-		getNearest8x8ImageSize(imgCPU.width, imgCPU.height, &newWidth, &newHeight);
-	}
-
-	// create a new and larger vector to store the new image
-	std::vector<cl_uint> h_largeimg (count);
-	// create a larger output vector to store the new output image
-	std::vector<cl_uint> h_largeoutput (count);
-
-	// at this point, the original image vector has been converted to YCbCr
-	// and extra padding has been added to the image to make the image dims divisible by 8
-	copyOntoLargerVectorWithPadding(h_outputGpu, h_largeimg, imgCPU.width, imgCPU.height, newWidth, newHeight);
-
-	queue.enqueueWriteBuffer(d_input, true, 0, size, h_largeimg.data(), NULL, NULL);
-
-	memset(h_largeoutput.data(), 255, size);
-
-	queue.enqueueWriteBuffer(d_output, true, 0, size, h_largeoutput.data(), NULL, NULL);
-
-	cl::Event chromaSubsamplingEvent;
-	// create a kernel object for chroma subsampling
-	cl::Kernel chromaSubsamplingKernel(program, "chromaSubsamplingKernel");
-	chromaSubsamplingKernel.setArg<cl::Buffer>(0, d_input);
-	chromaSubsamplingKernel.setArg<cl::Buffer>(1, d_output);
-	chromaSubsamplingKernel.setArg<cl_uint>(2, (cl_uint)newWidth);
-	chromaSubsamplingKernel.setArg<cl_uint>(3, (cl_uint)newHeight);
-
-	// Launch kernel on the compute device
-	queue.enqueueNDRangeKernel(chromaSubsamplingKernel, cl::NullRange, cl::NDRange(countX, countY), cl::NDRange(wgSizeX, wgSizeY), NULL, &chromaSubsamplingEvent);
-
-	// Copy output data back to host
-	queue.enqueueReadBuffer(d_output, true, 0, size, h_largeoutput.data(), NULL, NULL);
-
-	// Wait for all commands to complete
-	queue.finish();
-
-	// Print performance data
-	Core::TimeSpan chromaSubsamplingTimeGPU = OpenCL::getElapsedTime(chromaSubsamplingEvent);
-	std::cout << "Chroma subsampling time (GPU): " << chromaSubsamplingTimeGPU.toString() << std::endl;
-
-	// testing 
-	std::vector<cl_uint> h_img_test(newWidth * newHeight * 3);
-	switchVectorChannelOrdering(h_largeoutput, h_img_test, newWidth, newHeight);
-	writeVectorToFile("../data/fruitGPU_subsampling_output.ppm", newWidth, newHeight, h_img_test);
-
-	//////////////////////////////////////////////////////////////////////////////////////////////////////////
-
-	//////////////////////////////////// Level Shifting and DCT (GPU) ///////////////////////////////////////
+	getPaddedImageSize(imgCPU.width, imgCPU.height, subsamplingX, subsamplingY, &newWidth, &newHeight);
+	// number of samples of the Y plane and the subsampled Cb and Cr planes
+	size_t numSamples = getPlaneOffset(newWidth, newHeight, subsamplingX, subsamplingY, numComponents);
 
-	// Level shift the chroma channels by 128
-	std::vector<float> hDCTinput (h_largeoutput.begin(), h_largeoutput.end());
-	std::vector<float> hDCTintermediate (count);
-
-	// create buffers for DCT and level shifting
-	cl::Buffer dDCTinput = cl::Buffer(context, CL_MEM_READ_WRITE, size * sizeof (float));
-	cl::Buffer dDCTintermediate = cl::Buffer(context, CL_MEM_READ_WRITE, size * sizeof (float));
-
-	// write DCT input data to device
-	queue.enqueueWriteBuffer(dDCTinput, true, 0, count * sizeof (float), hDCTinput.data(), NULL, NULL);
-
-	cl::Event LevelShiftEvent;
-	// create a kernel object for level shifting
-	cl::Kernel LevelShiftKernel(program, "LevelShiftKernel");
-	LevelShiftKernel.setArg<cl::Buffer>(0, dDCTinput);
-	LevelShiftKernel.setArg<cl::Buffer>(1, dDCTintermediate);
-	LevelShiftKernel.setArg<cl_uint>(2, (cl_uint)newWidth);
-	LevelShiftKernel.setArg<cl_uint>(3, (cl_uint)newHeight);
-
-	// Launch kernel on the compute device
-	queue.enqueueNDRangeKernel(LevelShiftKernel, cl::NullRange, cl::NDRange(countX, countY), cl::NDRange(wgSizeX, wgSizeY), NULL, &LevelShiftEvent);
-
-	// Copy output data back to host
-	queue.enqueueReadBuffer(dDCTintermediate, true, 0, count * sizeof (float), hDCTintermediate.data(), NULL, NULL);
-
-	// Wait for all commands to complete
-	queue.finish();
-
-	// Print performance data
-	Core::TimeSpan LevelShiftTimeGPU = OpenCL::getElapsedTime(LevelShiftEvent);
-	std::cout << "Level shift time (GPU): " << LevelShiftTimeGPU.toString() << std::endl;
-
-	// perform DCT on the image
-	std::vector<float> hDCToutput (count);
-
-	// creat buffer for DCT output
-	cl::Buffer dDCToutput = cl::Buffer(context, CL_MEM_READ_WRITE, count * sizeof (float));
-
-	// copy DCT intermediate data to device (this will serve as input for DCT)
-	queue.enqueueWriteBuffer(dDCTintermediate, true, 0, count * sizeof (float), hDCTintermediate.data(), NULL, NULL);
+	// the samples of the padded image as float are the largest buffers of the GPU path
+	if (numSamples * sizeof (cl_float) > mappedInput.maxAllocSize) {
+		std::cerr << "The image needs buffers of " << numSamples * sizeof (cl_float) << " bytes, the device allows at most " << mappedInput.maxAllocSize << " bytes" << std::endl;
+		return 1;
+	}
 
-	cl::Event DCTEvent;
-	// create a kernel object for DCT
-	cl::Kernel DCTKernel(program, "DCTKernel");
-	DCTKernel.setArg<cl::Buffer>(0, dDCTintermediate);
-	DCTKernel.setArg<cl::Buffer>(1, dDCToutput);
-	DCTKernel.setArg<cl_uint>(2, (cl_uint)newWidth);
-	DCTKernel.setArg<cl_uint>(3, (cl_uint)newHeight);
+	// check the packed Huffman tables against the reference string tables
+	if (!checkHuffmanTables()) {
+		std::cout << "Huffman table self-check failed" << std::endl;
+		return 1;
+	}
 
-	// Launch kernel on the compute device
-	queue.enqueueNDRangeKernel(DCTKernel, cl::NullRange, cl::NDRange(countX, countY), cl::NDRange(wgSizeX, wgSizeY), NULL, &DCTEvent);
+	// accuracy self-checks of the CPU path (with -c, they are not part of the encoding)
+	if (options.checkGPU) {
+		// check the fixed-point color space conversion of the CPU path
+		if (!checkCSCAccuracy()) {
+			std::cout << "CSC accuracy check failed" << std::endl;
+			return 1;
+		}
 
-	// Copy output data back to host
-	queue.enqueueReadBuffer(dDCToutput, true, 0, count * sizeof (float), hDCToutput.data(), NULL, NULL);
+		// check the selected DCT and quantization of the CPU path against the reference DCT
+		if (options.dctMethod != DCT_REFERENCE && !checkDCTAccuracy(options.dctMethod, quant_mat_lum, quant_mat_chrom)) {
+			std::cout << "DCT accuracy check failed" << std::endl;
+			return 1;
+		}
+	}
 
-	// Wait for all commands to complete
-	queue.finish();
+	// create an instance of cpu_telemetry
+	CPUTelemetry cpu_telemetry;
+	// perform the JPEG encoding on the CPU, it reads the pixels from the mapped input buffer and does not write them
+	// (with -c the coefficients are kept for the comparison with the GPU)
+	std::vector<int16_t> coeffsCPU;
+	JpegEncoderHost(imgCPU, options, &cpu_telemetry, options.checkGPU ? &coeffsCPU : NULL);
+
+	// Hand the input data to the device by unmapping the buffer the image was read into (no copy through pageable
+	// memory). From here on the data stays on the device: the kernels are chained with event wait lists and only
+	// the bit stream is read back (with -c also the intermediate results for the checks)
+	cl::Event inputEvent;
+	queue.enqueueUnmapMemObject(d_input, imgCPU.data, NULL, &inputEvent);
+	imgCPU.data = NULL;
 
-	// Print performance data
-	Core::TimeSpan DCTTimeGPU = OpenCL::getElapsedTime(DCTEvent);
-	std::cout << "DCT time (GPU): " << DCTTimeGPU.toString() << std::endl;
+	std::cout << "\n### GPU Implementation ###" << std::endl;
 
-	//////////////////////////////////////////////////////////////////////////////////////////////////////////
+	// coefficients of the Y plane and the subsampled Cb and Cr planes
+	unsigned int dims = numSamples;
 
-	//////////////////////////////////// Quantization (GPU) ////////////////////////////////////////////////
+	// global sizes of the 2-D kernels: the padded Y plane (DCT, quantization) and Cb/Cr plane (color conversion,
+	// one work item per Cb/Cr sample) rounded up to whole work groups, the work items outside of the planes return
+	std::size_t globalX = roundUpToMultiple(newWidth, wgSizeX);
+	std::size_t globalY = roundUpToMultiple(newHeight, wgSizeY);
+	std::size_t chromaGlobalX = roundUpToMultiple(getPlaneSize(newWidth, subsamplingX, 1), wgSizeX);
+	std::size_t chromaGlobalY = roundUpToMultiple(getPlaneSize(newHeight, subsamplingY, 1), wgSizeY);
 
-	// create a vector of type *float* to store newInput data
-	std::vector<float> h_newinput (hDCToutput.begin(), hDCToutput.end());
-	// create a vector to store newOutput data
-	std::vector<int> h_newoutput (size);
 	// create a vector a fill it with quantization matrix for luminance
 	std::vector<cl_uint> h_quant_mat_lum (64);
 	// copy the quantization matrix for luminance
@@ -502,131 +609,612 @@ int main(int argc, char** argv) {
 	for (size_t i = 0; i < 64; ++i) {
 		h_quant_mat_chrom[i] = quant_mat_chrom[i / 8][i % 8];
 	}
-
-	memset(h_newoutput.data(), 255, size);
-
-	// allocate buffer for newInput data
-	cl::Buffer d_finput = cl::Buffer(context, CL_MEM_READ_WRITE, size * sizeof (cl_float));
-	// allocate buffer for newOutput data
-	cl::Buffer d_foutput = cl::Buffer(context, CL_MEM_READ_WRITE, size * sizeof (int));
 	// allocate buffer for quantization matrix for luminance
 	cl::Buffer d_matA = cl::Buffer(context, CL_MEM_READ_ONLY, 64 * sizeof (cl_uint));
 	// allocate buffer for quantization matrix for chrominance
 	cl::Buffer d_matB = cl::Buffer(context, CL_MEM_READ_ONLY, 64 * sizeof (cl_uint));
-
-	// write newInput data to device
-	queue.enqueueWriteBuffer(d_finput, true, 0, size * sizeof (cl_float), h_newinput.data(), NULL, NULL);
 	// write quantization matrix for luminance to device
-	queue.enqueueWriteBuffer(d_matA, true, 0, 64 * sizeof (cl_uint), h_quant_mat_lum.data(), NULL, NULL);
+	cl::Event quantLumEvent;
+	queue.enqueueWriteBuffer(d_matA, false, 0, 64 * sizeof (cl_uint), h_quant_mat_lum.data(), NULL, &quantLumEvent);
 	// write quantization matrix for chrominance to device
-	queue.enqueueWriteBuffer(d_matB, true, 0, 64 * sizeof (cl_uint), h_quant_mat_chrom.data(), NULL, NULL);
-	// write newOutput data to device
-	queue.enqueueWriteBuffer(d_foutput, true, 0, size * sizeof (int), h_newoutput.data(), NULL, NULL);
+	cl::Event quantChromEvent;
+	queue.enqueueWriteBuffer(d_matB, false, 0, 64 * sizeof (cl_uint), h_quant_mat_chrom.data(), NULL, &quantChromEvent);
+
+	// the mirror padding of images smaller than an MCU has to be the same in both GPU pipelines
+	if (options.checkGPU && !checkFusedPipelineSmallImage(context, queue, program, d_matA, d_matB, options.dctMethod, numComponents, subsamplingX, subsamplingY)) {
+		std::cout << "Fused MCU kernel (GPU) does not match the per-stage kernels" << std::endl;
+		return 1;
+	}
 
+	// the events the next kernel of the chain waits for: the uploads, then the previous kernel
+	std::vector<cl::Event> waitEvents;
+	waitEvents.push_back(inputEvent);
+	waitEvents.push_back(quantLumEvent);
+	waitEvents.push_back(quantChromEvent);
+
+	// the quantized coefficients in zigzag order, stored block after block: the input of the entropy coding
+	// (only read back for the checks and the host entropy coding with restart markers)
+	std::vector<cl_short> zigzagOutput;
+	cl::Buffer d_zigzagOutput = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof (cl_short) * dims);
+
+	// kernels of the per-stage pipeline, or the fused kernel
+	cl::Event fusedEvent;
+	cl::Event colorConversionEvent;
+	cl::Event DCTEvent;
 	cl::Event quantizationEvent;
+	cl::Event zigzagEvent;
 
-	// create a kernel object for quantization
-	cl::Kernel quantizationKernel(program, "quantizationKernel");
-	quantizationKernel.setArg<cl::Buffer>(0, d_finput);
-	quantizationKernel.setArg<cl::Buffer>(1, d_foutput);
-	quantizationKernel.setArg<cl::Buffer>(2, d_matA);
-	quantizationKernel.setArg<cl::Buffer>(3, d_matB);
-	quantizationKernel.setArg<cl_uint>(4, (cl_uint)imgCPU.width);
-	quantizationKernel.setArg<cl_uint>(5, (cl_uint)imgCPU.height);
+	if (options.gpuPipeline == GPU_PIPELINE_FUSED) {
+		//////////////////////////////////// Fused MCU Kernel (GPU) ///////////////////////////////////////////
+
+		// basis matrix of the 1-D DCT in constant memory (not used by the integer DCT)
+		std::vector<cl_float> hDCTmatrix(64);
+		getDCTMatrix(hDCTmatrix.data());
+		cl::Buffer dDCTmatrix = cl::Buffer(context, CL_MEM_READ_ONLY, 64 * sizeof (cl_float));
+		cl::Event DCTmatrixEvent;
+		queue.enqueueWriteBuffer(dDCTmatrix, false, 0, 64 * sizeof (cl_float), hDCTmatrix.data(), NULL, &DCTmatrixEvent);
+		waitEvents.push_back(DCTmatrixEvent);
+
+		// one work group of 8x8 work items per MCU, the samples and the row pass of the MCU in local memory
+		unsigned int mcuBlocks = subsamplingX * subsamplingY + numComponents - 1;
+		std::size_t mcuCols = newWidth / (8 * subsamplingX);
+		std::size_t mcuRows = newHeight / (8 * subsamplingY);
+
+		cl::Kernel encodeMCUKernel(program, "encodeMCUKernel");
+		encodeMCUKernel.setArg<cl::Buffer>(0, d_input);
+		encodeMCUKernel.setArg<cl::Buffer>(1, d_zigzagOutput);
+		encodeMCUKernel.setArg<cl::Buffer>(2, dDCTmatrix);
+		encodeMCUKernel.setArg<cl::Buffer>(3, d_matA);
+		encodeMCUKernel.setArg<cl::Buffer>(4, d_matB);
+		encodeMCUKernel.setArg(5, cl::Local(mcuBlocks * 64 * sizeof (cl_float)));
+		encodeMCUKernel.setArg(6, cl::Local(mcuBlocks * 64 * sizeof (cl_float)));
+		encodeMCUKernel.setArg<cl_uint>(7, (cl_uint)(options.dctMethod == DCT_INT));
+		encodeMCUKernel.setArg<cl_uint>(8, (cl_uint)imgCPU.width);
+		encodeMCUKernel.setArg<cl_uint>(9, (cl_uint)imgCPU.height);
+		encodeMCUKernel.setArg<cl_uint>(10, (cl_uint)newWidth);
+		encodeMCUKernel.setArg<cl_uint>(11, (cl_uint)newHeight);
+
+		// Launch kernel on the compute device
+		queue.enqueueNDRangeKernel(encodeMCUKernel, cl::NullRange, cl::NDRange(mcuCols * 8, mcuRows * 8), cl::NDRange(8, 8), &waitEvents, &fusedEvent);
+		waitEvents.assign(1, fusedEvent);
+
+		///////////////////////////////////////////////////////////////////////////////////////////////////////
+	} else {
+		//////////////////////////// Color Space Conversion + Chroma Subsampling + Level Shifting (GPU) ////////////////
+
+		// the kernel reads the RGB pixels once and writes the level shifted Y plane and the subsampled,
+		// level shifted Cb and Cr planes of the padded image: the fixed-point conversion of the CPU, with the
+		// chroma planes subsampled before they are padded at chroma resolution, so the samples match the CPU path
+		cl::Buffer dDCTintermediate = cl::Buffer(context, CL_MEM_READ_WRITE, numSamples * sizeof (float));
+
+		// create a kernel object for the fused color conversion, chroma subsampling and level shifting
+		cl::Kernel colorConversionSubsamplingKernel(program, "colorConversionSubsamplingKernel");
+		colorConversionSubsamplingKernel.setArg<cl::Buffer>(0, d_input);
+		colorConversionSubsamplingKernel.setArg<cl::Buffer>(1, dDCTintermediate);
+		colorConversionSubsamplingKernel.setArg<cl_uint>(2, (cl_uint)imgCPU.width);
+		colorConversionSubsamplingKernel.setArg<cl_uint>(3, (cl_uint)imgCPU.height);
+		colorConversionSubsamplingKernel.setArg<cl_uint>(4, (cl_uint)newWidth);
+		colorConversionSubsamplingKernel.setArg<cl_uint>(5, (cl_uint)newHeight);
+
+		// Launch kernel on the compute device, one work item per Cb/Cr sample (per Y sample for grayscale images)
+		queue.enqueueNDRangeKernel(colorConversionSubsamplingKernel, cl::NullRange, cl::NDRange(chromaGlobalX, chromaGlobalY), cl::NDRange(wgSizeX, wgSizeY), &waitEvents, &colorConversionEvent);
+		waitEvents.assign(1, colorConversionEvent);
+
+		// testing
+		std::vector<float> hDCTintermediate;
+		if (options.checkGPU) {
+			hDCTintermediate.resize(numSamples);
+			queue.enqueueReadBuffer(dDCTintermediate, true, 0, numSamples * sizeof (float), hDCTintermediate.data(), &waitEvents, NULL);
+
+			std::vector<cl_uint> h_largeoutput (numSamples);
+			for (size_t i = 0; i < numSamples; ++i) {
+				h_largeoutput[i] = (cl_uint)(hDCTintermediate[i] + 128);
+			}
+			std::vector<cl_uint> h_img_test(newWidth * newHeight * 3);
+			if (grayscale) {
+				// the Y plane for all three channels
+				for (size_t i = 0; i < newWidth * newHeight; ++i) {
+					h_img_test[3 * i] = h_img_test[3 * i + 1] = h_img_test[3 * i + 2] = h_largeoutput[i];
+				}
+			} else {
+				switchVectorChannelOrdering(h_largeoutput, h_img_test, newWidth, newHeight, subsamplingX, subsamplingY);
+			}
+			writeVectorToFile("../data/fruitGPU_subsampling_output.ppm", newWidth, newHeight, h_img_test);
+		}
 
-	// Launch quantization kernel on the compute device
-	queue.enqueueNDRangeKernel(quantizationKernel, cl::NullRange, cl::NDRange(countX, countY), cl::NDRange(wgSizeX, wgSizeY), NULL, &quantizationEvent);
-	// Copy output data back to host
-	queue.enqueueReadBuffer(d_foutput, true, 0, size * sizeof (int), h_newoutput.data(), NULL, NULL);
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+		//////////////////////////////////// DCT (GPU) //////////////////////////////////////////////////////////
+
+		// creat buffer for DCT output
+		cl::Buffer dDCToutput = cl::Buffer(context, CL_MEM_READ_WRITE, numSamples * sizeof (float));
+
+		// the integer DCT writes coefficients scaled by 8, which are quantized by quantizationIntKernel
+		cl::Buffer dDCTintOutput;
+		if (options.dctMethod == DCT_INT) {
+			dDCTintOutput = cl::Buffer(context, CL_MEM_READ_WRITE, numSamples * sizeof (cl_int));
+
+			// create a kernel object for the integer DCT, one work item per block and channel
+			cl::Kernel DCTIntKernel(program, "DCTIntKernel");
+			DCTIntKernel.setArg<cl::Buffer>(0, dDCTintermediate);
+			DCTIntKernel.setArg<cl::Buffer>(1, dDCTintOutput);
+			DCTIntKernel.setArg<cl_uint>(2, (cl_uint)newWidth);
+			DCTIntKernel.setArg<cl_uint>(3, (cl_uint)newHeight);
+
+			// Launch kernel on the compute device
+			queue.enqueueNDRangeKernel(DCTIntKernel, cl::NullRange, cl::NDRange(newWidth / 8, newHeight / 8, numComponents), cl::NullRange, &waitEvents, &DCTEvent);
+		} else if (options.gpuDCTKernel == GPU_DCT_TILED) {
+			// basis matrix of the 1-D DCT in constant memory
+			std::vector<cl_float> hDCTmatrix(64);
+			getDCTMatrix(hDCTmatrix.data());
+			cl::Buffer dDCTmatrix = cl::Buffer(context, CL_MEM_READ_ONLY, 64 * sizeof (cl_float));
+			cl::Event DCTmatrixEvent;
+			queue.enqueueWriteBuffer(dDCTmatrix, false, 0, 64 * sizeof (cl_float), hDCTmatrix.data(), NULL, &DCTmatrixEvent);
+			waitEvents.push_back(DCTmatrixEvent);
+
+			// create a kernel object for the tiled DCT, the work group size has to be a multiple of 8
+			cl::Kernel DCTTiledKernel(program, "DCTTiledKernel");
+			DCTTiledKernel.setArg<cl::Buffer>(0, dDCTintermediate);
+			DCTTiledKernel.setArg<cl::Buffer>(1, dDCToutput);
+			DCTTiledKernel.setArg<cl::Buffer>(2, dDCTmatrix);
+			DCTTiledKernel.setArg(3, cl::Local(numComponents * wgSizeX * wgSizeY * sizeof (cl_float)));
+			DCTTiledKernel.setArg(4, cl::Local(numComponents * wgSizeX * wgSizeY * sizeof (cl_float)));
+			DCTTiledKernel.setArg<cl_uint>(5, (cl_uint)newWidth);
+			DCTTiledKernel.setArg<cl_uint>(6, (cl_uint)newHeight);
+
+			// Launch kernel on the compute device
+			queue.enqueueNDRangeKernel(DCTTiledKernel, cl::NullRange, cl::NDRange(globalX, globalY), cl::NDRange(wgSizeX, wgSizeY), &waitEvents, &DCTEvent);
+		} else {
+			// create a kernel object for DCT
+			cl::Kernel DCTKernel(program, "DCTKernel");
+			DCTKernel.setArg<cl::Buffer>(0, dDCTintermediate);
+			DCTKernel.setArg<cl::Buffer>(1, dDCToutput);
+			DCTKernel.setArg<cl_uint>(2, (cl_uint)newWidth);
+			DCTKernel.setArg<cl_uint>(3, (cl_uint)newHeight);
+
+			// Launch kernel on the compute device
+			queue.enqueueNDRangeKernel(DCTKernel, cl::NullRange, cl::NDRange(globalX, globalY), cl::NDRange(wgSizeX, wgSizeY), &waitEvents, &DCTEvent);
+		}
+		waitEvents.assign(1, DCTEvent);
+
+		// check the tiled DCT against the AAN DCT on the CPU
+		if (options.checkGPU && options.dctMethod != DCT_INT && options.gpuDCTKernel == GPU_DCT_TILED) {
+			std::vector<float> hDCToutput (numSamples);
+			queue.enqueueReadBuffer(dDCToutput, true, 0, numSamples * sizeof (float), hDCToutput.data(), &waitEvents, NULL);
+
+			// the scalar AAN DCT of the CPU, only descaled (no quantization)
+			DCTQuantBlockFunc dctQuantBlock = getDCTQuantBlockFunc(SIMD_SCALAR);
+			float descale[64];
+			getDCTQuantScale(NULL, descale);
+			double maxError = 0.0;
+			float block[64];
+			float coeffs[64];
+			for (size_t c = 0; c < numComponents; ++c) {
+				size_t planeWidth = getPlaneSize(newWidth, subsamplingX, c);
+				size_t planeHeight = getPlaneSize(newHeight, subsamplingY, c);
+				for (size_t by = 0; by < planeHeight; by += 8) {
+					for (size_t bx = 0; bx < planeWidth; bx += 8) {
+						size_t offset = getPlaneOffset(newWidth, newHeight, subsamplingX, subsamplingY, c) + by * planeWidth + bx;
+						for (size_t i = 0; i < 64; ++i) {
+							block[i] = hDCTintermediate[offset + (i / 8) * planeWidth + i % 8];
+						}
+						dctQuantBlock(block, coeffs, descale, false);
+						for (size_t i = 0; i < 64; ++i) {
+							maxError = std::max(maxError, (double)std::fabs(coeffs[i] - hDCToutput[offset + (i / 8) * planeWidth + i % 8]));
+						}
+					}
+				}
+			}
+			std::cout << "DCT (GPU, tiled): max. coefficient error " << maxError << std::endl;
+			// single precision on the device
+			if (maxError > 1e-2) {
+				std::cout << "Tiled DCT (GPU) does not match the CPU DCT" << std::endl;
+				return 1;
+			}
+		}
 
-	// Wait for all commands to complete
-	queue.finish();
+		// the integer DCT has to give the same coefficients as on the CPU
+		if (options.checkGPU && options.dctMethod == DCT_INT) {
+			std::vector<cl_int> hDCTintOutput (numSamples);
+			queue.enqueueReadBuffer(dDCTintOutput, true, 0, numSamples * sizeof (cl_int), hDCTintOutput.data(), &waitEvents, NULL);
+
+			DCTIntBlockFunc dctIntBlock = getDCTIntBlockFunc(detectSimdLevel());
+			size_t mismatches = 0;
+			int block[64];
+			int coeffs[64];
+			for (size_t c = 0; c < numComponents; ++c) {
+				size_t planeWidth = getPlaneSize(newWidth, subsamplingX, c);
+				size_t planeHeight = getPlaneSize(newHeight, subsamplingY, c);
+				for (size_t by = 0; by < planeHeight; by += 8) {
+					for (size_t bx = 0; bx < planeWidth; bx += 8) {
+						size_t offset = getPlaneOffset(newWidth, newHeight, subsamplingX, subsamplingY, c) + by * planeWidth + bx;
+						for (size_t i = 0; i < 64; ++i) {
+							block[i] = (int)hDCTintermediate[offset + (i / 8) * planeWidth + i % 8];
+						}
+						dctIntBlock(block, coeffs);
+						for (size_t i = 0; i < 64; ++i) {
+							if (coeffs[i] != hDCTintOutput[offset + (i / 8) * planeWidth + i % 8]) {
+								++mismatches;
+							}
+						}
+					}
+				}
+			}
+			if (mismatches != 0) {
+				std::cout << "Integer DCT (GPU) differs from the CPU in " << mismatches << " coefficients" << std::endl;
+				return 1;
+			}
+			std::cout << "Integer DCT (GPU) is bit-identical to the CPU (" << getSimdLevelName(detectSimdLevel()) << ")" << std::endl;
+		}
 
-	// Print performance data
-	Core::TimeSpan quantizationTimeGPU = OpenCL::getElapsedTime(quantizationEvent);
-	std::cout << "Quantization time (GPU): " << quantizationTimeGPU.toString() << std::endl;
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-	///////////////////////////////////////////////////////////////////////////////////////////////////////
+		//////////////////////////////////// Quantization (GPU) ////////////////////////////////////////////////
 
-	//////////////////////////////////// ZigZag Scanning (GPU) ///////////////////////////////////////////
+		// allocate buffer for the quantized coefficients: 16 bit, stored block after block (like coeff_image_t)
+		cl::Buffer d_foutput = cl::Buffer(context, CL_MEM_READ_WRITE, dims * sizeof (cl_short));
 
-	int zigzagInput[newWidth * newHeight * 3];
-	int zigzagOutput[newWidth * newHeight * 3];
+		// create a kernel object for quantization, it reads the DCT output on the device
+		cl::Kernel quantizationKernel;
+		if (options.dctMethod == DCT_INT) {
+			quantizationKernel = cl::Kernel(program, "quantizationIntKernel");
+			quantizationKernel.setArg<cl::Buffer>(0, dDCTintOutput);
+		} else {
+			quantizationKernel = cl::Kernel(program, "quantizationKernel");
+			quantizationKernel.setArg<cl::Buffer>(0, dDCToutput);
+		}
+		quantizationKernel.setArg<cl::Buffer>(1, d_foutput);
+		quantizationKernel.setArg<cl::Buffer>(2, d_matA);
+		quantizationKernel.setArg<cl::Buffer>(3, d_matB);
+		quantizationKernel.setArg<cl_uint>(4, (cl_uint)newWidth);
+		quantizationKernel.setArg<cl_uint>(5, (cl_uint)newHeight);
 
-	everyMCUisnow1DArray(h_newoutput, zigzagInput, newWidth, newHeight);
+		// Launch quantization kernel on the compute device
+		queue.enqueueNDRangeKernel(quantizationKernel, cl::NullRange, cl::NDRange(globalX, globalY), cl::NDRange(wgSizeX, wgSizeY), &waitEvents, &quantizationEvent);
+		waitEvents.assign(1, quantizationEvent);
 
-	unsigned int dims = newWidth * newHeight * 3;
+		///////////////////////////////////////////////////////////////////////////////////////////////////////
 
-	// allocate buffer for zigzagInput data
-	cl::Buffer d_zigzagInput = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof (int) * dims);
-	// allocate buffer for zigzagOutput data
-	cl::Buffer d_zigzagOutput = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof (int) * dims);
+		//////////////////////////////////// ZigZag Scanning (GPU) ///////////////////////////////////////////
 
-	// write zigzagInput data to device
-	queue.enqueueWriteBuffer(d_zigzagInput, true, 0, dims * sizeof (int), zigzagInput, NULL, NULL);
-	
-	cl::Event zigzagEvent;
-	// create a kernel object for zigzag
-	cl::Kernel zigzagKernel(program, "zigzagKernel");
-	zigzagKernel.setArg<cl::Buffer>(0, d_zigzagInput);
-	zigzagKernel.setArg<cl::Buffer>(1, d_zigzagOutput);
+		// the quantization kernel already stores the coefficients block after block,
+		// so the zigzag kernel reads them straight from the device without a round trip through the host
+		// create a kernel object for zigzag
+		cl::Kernel zigzagKernel(program, "zigzagKernel");
+		zigzagKernel.setArg<cl::Buffer>(0, d_foutput);
+		zigzagKernel.setArg<cl::Buffer>(1, d_zigzagOutput);
+		zigzagKernel.setArg<cl_uint>(2, (cl_uint)(dims / 64));
 
-	// Launch zigzag kernel on the compute device
-	queue.enqueueNDRangeKernel(zigzagKernel, cl::NullRange, cl::NDRange(dims / 64, 64), cl::NDRange(wgSizeX, wgSizeY), NULL, &zigzagEvent);
-	// Copy output data back to host
-	queue.enqueueReadBuffer(d_zigzagOutput, true, 0, dims * sizeof (int), zigzagOutput, NULL, NULL);
+		// Launch zigzag kernel on the compute device
+		queue.enqueueNDRangeKernel(zigzagKernel, cl::NullRange, cl::NDRange(roundUpToMultiple(dims / 64, wgSizeX), 64), cl::NDRange(wgSizeX, wgSizeY), &waitEvents, &zigzagEvent);
+		waitEvents.assign(1, zigzagEvent);
 
-	// Wait for all commands to complete
-	queue.finish();
+		///////////////////////////////////////////////////////////////////////////////////////////////////////
+	}
 
-	Core::TimeSpan zigzagTimeGPU = OpenCL::getElapsedTime(zigzagEvent);
-	std::cout << "ZigZag time (GPU): " << zigzagTimeGPU.toString() << std::endl;
+	// the host only needs the coefficients for the checks
+	if (options.checkGPU) {
+		zigzagOutput.resize(dims);
+		queue.enqueueReadBuffer(d_zigzagOutput, true, 0, dims * sizeof (cl_short), zigzagOutput.data(), &waitEvents, NULL);
+	}
 
-	///////////////////////////////////////////////////////////////////////////////////////////////////////
+	// with the integer DCT both paths compute the same samples and coefficients (either GPU pipeline)
+	if (options.checkGPU && options.dctMethod == DCT_INT) {
+		size_t mismatches = 0;
+		for (size_t i = 0; i < dims; ++i) {
+			if (zigzagOutput[i] != coeffsCPU[(i / 64) * 64 + zigzag_order[i % 64]]) {
+				++mismatches;
+			}
+		}
+		std::cout << "Coefficients (GPU, int): " << mismatches << " different from the CPU" << std::endl;
+		if (mismatches > 0) {
+			std::cout << "Coefficients of the GPU do not match the CPU" << std::endl;
+			return 1;
+		}
+	}
 
 	//////////////////////////////////// RLE Encoding (GPU) //////////////////////////////////////////////
-	// Run Length Encoding
-	int dims_for_rle = dims / 64 * 66;
-	int rleOutput[dims_for_rle];
-
-	// allocate buffer for rle step
-	cl::Buffer d_rleInput = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof (int) * dims);
-	// allocate buffer for rleOutput data
-	cl::Buffer d_rleOutput = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof (int) * dims_for_rle);
+	// Run Length Encoding with stream compaction: (1) number of (run, value) pairs of every block,
+	// (2) exclusive scan of the counts = pair offset of every block, (3) every block writes its pairs
+	// densely packed at its offset. A block has at most 64 pairs, so the output is allocated for the
+	// worst case. The Huffman kernels code the packed pairs, they are only read back for the check.
+	unsigned int numRLEBlocks = dims / 64;
+
+	// the scan kernel needs a power of two work items per work group (each scans 2 elements in local memory):
+	// the largest one the device and the kernel allow
+	cl::Kernel exclusiveScanKernel(program, "exclusiveScanKernel");
+	cl::Kernel addGroupOffsetsKernel(program, "addGroupOffsetsKernel");
+	std::size_t maxWorkGroupSizeScan = std::min(maxWorkGroupSize, exclusiveScanKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+	std::size_t wgSizeScan = 1;
+	while (2 * wgSizeScan <= maxWorkGroupSizeScan) {
+		wgSizeScan *= 2;
+	}
 
-	// write zigzagOutput data to device
-	queue.enqueueWriteBuffer(d_rleInput, true, 0, dims * sizeof (int), zigzagOutput, NULL, NULL);
+	cl::Buffer d_pairCounts = cl::Buffer(context, CL_MEM_READ_WRITE, numRLEBlocks * sizeof (cl_uint));
+	cl::Buffer d_pairOffsets = cl::Buffer(context, CL_MEM_READ_WRITE, numRLEBlocks * sizeof (cl_uint));
+	cl::Buffer d_rleOutput = cl::Buffer(context, CL_MEM_READ_WRITE, numRLEBlocks * 64 * 2 * sizeof (cl_short));
+
+	cl::Event rleCountEvent;
+	cl::Kernel rleCountKernel(program, "rleCountKernel");
+	rleCountKernel.setArg<cl::Buffer>(0, d_zigzagOutput);
+	rleCountKernel.setArg<cl::Buffer>(1, d_pairCounts);
+	rleCountKernel.setArg<cl_uint>(2, numRLEBlocks);
+	queue.enqueueNDRangeKernel(rleCountKernel, cl::NullRange, cl::NDRange(numRLEBlocks), cl::NullRange, &waitEvents, &rleCountEvent);
+
+	// keep the counts for the total size, scan a copy into the offsets
+	std::vector<cl::Event> rleCountDone(1, rleCountEvent);
+	cl::Event rleCopyEvent;
+	queue.enqueueCopyBuffer(d_pairCounts, d_pairOffsets, 0, 0, numRLEBlocks * sizeof (cl_uint), &rleCountDone, &rleCopyEvent);
+	std::vector<cl::Event> rleCopyDone(1, rleCopyEvent);
+	std::vector<cl::Event> rleScanEvents;
+	enqueueExclusiveScan(context, queue, exclusiveScanKernel, addGroupOffsetsKernel, d_pairOffsets, numRLEBlocks, wgSizeScan, &rleCopyDone, rleScanEvents);
+
+	cl::Event rleCompactEvent;
+	std::vector<cl::Event> rleScanDone(1, rleScanEvents.back());
+	cl::Kernel rleCompactKernel(program, "rleCompactKernel");
+	rleCompactKernel.setArg<cl::Buffer>(0, d_zigzagOutput);
+	rleCompactKernel.setArg<cl::Buffer>(1, d_pairOffsets);
+	rleCompactKernel.setArg<cl::Buffer>(2, d_rleOutput);
+	rleCompactKernel.setArg<cl_uint>(3, numRLEBlocks);
+	queue.enqueueNDRangeKernel(rleCompactKernel, cl::NullRange, cl::NDRange(numRLEBlocks), cl::NullRange, &rleScanDone, &rleCompactEvent);
+
+	// the Huffman kernels start from the packed pairs
+	std::vector<cl::Event> rleCompactDone(1, rleCompactEvent);
+
+	// check the pairs against the host RLE: (0, DC) followed by the AC pairs of RLEBlockAC
+	size_t numPairs = 0;
+	if (options.checkGPU) {
+		// offset table with the total number of pairs as last entry
+		std::vector<cl_uint> h_pairOffsets(numRLEBlocks + 1);
+		cl_uint lastPairCount;
+		queue.enqueueReadBuffer(d_pairOffsets, true, 0, numRLEBlocks * sizeof (cl_uint), h_pairOffsets.data(), &rleCompactDone, NULL);
+		queue.enqueueReadBuffer(d_pairCounts, true, (numRLEBlocks - 1) * sizeof (cl_uint), sizeof (cl_uint), &lastPairCount, &rleCompactDone, NULL);
+		h_pairOffsets[numRLEBlocks] = h_pairOffsets[numRLEBlocks - 1] + lastPairCount;
+		numPairs = h_pairOffsets[numRLEBlocks];
+
+		// Copy the packed pairs back to host
+		std::vector<cl_short> rleOutput(numPairs * 2);
+		queue.enqueueReadBuffer(d_rleOutput, true, 0, numPairs * 2 * sizeof (cl_short), rleOutput.data(), &rleCompactDone, NULL);
+
+		for (size_t i = 0; i < numRLEBlocks; i++) {
+			int zigzagBlock[64];
+			std::copy(zigzagOutput.begin() + i * 64, zigzagOutput.begin() + (i + 1) * 64, zigzagBlock);
+			std::vector<int> rleBlock;
+			rleBlock.push_back(0);
+			rleBlock.push_back(zigzagBlock[0]);
+			RLEBlockAC(zigzagBlock, rleBlock);
+			if (rleBlock.size() != 2 * (h_pairOffsets[i + 1] - h_pairOffsets[i]) || !std::equal(rleBlock.begin(), rleBlock.end(), rleOutput.begin() + 2 * h_pairOffsets[i])) {
+				std::cout << "Error: the RLE output of the GPU differs from the host for block " << i << std::endl;
+				return 1;
+			}
+		}
+	}
 
-	cl::Event rleEvent;
-	// create a kernel object for rle
-	cl::Kernel rleKernel(program, "rleKernel");
-	rleKernel.setArg<cl::Buffer>(0, d_rleInput);
-	rleKernel.setArg<cl::Buffer>(1, d_rleOutput);
+	///////////////////////////////////////////////////////////////////////////////////////////////////////
 
-	// run length encoding in single index
-	queue.enqueueNDRangeKernel(rleKernel, 0, dims / 64, 64, NULL, &rleEvent);
+	//////////////////////////////////// Huffman Encoding (GPU) /////////////////////////////////////////
+
+	// The packed RLE pairs of the blocks are Huffman coded on the device:
+	// (1) bit length of every block, (2) exclusive scan of the lengths = bit offset of every block,
+	// (3) byte length of every restart interval (the whole scan without -r) and their exclusive scan,
+	// (4) every block writes its codes at its offset, the intervals are padded to whole bytes.
+	// Only the packed bit stream and the interval offsets are read back.
+	// An MCU holds subsamplingX * subsamplingY Y blocks, one Cb and one Cr block (one Y block for grayscale images).
+	unsigned int mcusPerRow = newWidth / (8 * subsamplingX);
+	unsigned int numMCUs = mcusPerRow * (newHeight / (8 * subsamplingY));
+	unsigned int mcuBlocks = subsamplingX * subsamplingY + numComponents - 1;
+	unsigned int numBlocks = numMCUs * mcuBlocks;
+	// huffman tables: Annex K, or optimized for the image from the symbol histograms of the GPU
+	HuffmanTableSet huffmanTablesGPU = getStandardHuffmanTables();
+	cl::Event huffmanHistogramEvent;
+	if (options.optimizeHuffman) {
+		std::size_t wgSizeHistogram = 64;
+		cl::Buffer d_histograms = cl::Buffer(context, CL_MEM_READ_WRITE, 4 * 256 * sizeof (cl_uint));
+		cl::Event histogramFillEvent;
+		queue.enqueueFillBuffer(d_histograms, (cl_uint)0, 0, 4 * 256 * sizeof (cl_uint), NULL, &histogramFillEvent);
+		std::vector<cl::Event> histogramWaitEvents(rleCompactDone);
+		histogramWaitEvents.push_back(histogramFillEvent);
+
+		cl::Kernel huffmanHistogramKernel(program, "huffmanHistogramKernel");
+		huffmanHistogramKernel.setArg<cl::Buffer>(0, d_rleOutput);
+		huffmanHistogramKernel.setArg<cl::Buffer>(1, d_pairOffsets);
+		huffmanHistogramKernel.setArg<cl::Buffer>(2, d_pairCounts);
+		huffmanHistogramKernel.setArg<cl::Buffer>(3, d_histograms);
+		huffmanHistogramKernel.setArg(4, cl::Local(4 * 256 * sizeof (cl_uint)));
+		huffmanHistogramKernel.setArg<cl_uint>(5, numMCUs);
+		huffmanHistogramKernel.setArg<cl_uint>(6, mcusPerRow);
+		huffmanHistogramKernel.setArg<cl_uint>(7, options.restartInterval);
+		queue.enqueueNDRangeKernel(huffmanHistogramKernel, cl::NullRange, cl::NDRange(roundUpToMultiple(numBlocks, wgSizeHistogram)), cl::NDRange(wgSizeHistogram), &histogramWaitEvents, &huffmanHistogramEvent);
+
+		// the tables are built on the host, the histograms (4 KB) are the only intermediate result read back
+		std::vector<cl::Event> histogramDone(1, huffmanHistogramEvent);
+		uint32_t histograms[4][256];
+		queue.enqueueReadBuffer(d_histograms, true, 0, sizeof (histograms), histograms, &histogramDone, NULL);
+		buildOptimalHuffmanTables(histograms, &huffmanTablesGPU);
+	}
 
-	// Copy output data back to host
-	queue.enqueueReadBuffer(d_rleOutput, true, 0, dims_for_rle * sizeof (int), rleOutput, NULL, NULL);
+	std::vector<cl_uint> h_huffmanTables;
+	getDeviceHuffmanTables(huffmanTablesGPU, h_huffmanTables);
+	cl::Buffer d_huffmanTables = cl::Buffer(context, CL_MEM_READ_ONLY, h_huffmanTables.size() * sizeof (cl_uint));
+	cl::Event huffmanTablesEvent;
+	queue.enqueueWriteBuffer(d_huffmanTables, false, 0, h_huffmanTables.size() * sizeof (cl_uint), h_huffmanTables.data(), NULL, &huffmanTablesEvent);
+	std::vector<cl::Event> huffmanWaitEvents(rleCompactDone);
+	huffmanWaitEvents.push_back(huffmanTablesEvent);
+
+	// bit length of every block in scan order (the Y blocks, Cb and Cr of every MCU), scanned in place into bit offsets
+	cl::Buffer d_blockBits = cl::Buffer(context, CL_MEM_READ_WRITE, numBlocks * sizeof (cl_uint));
+	cl::Buffer d_blockOffsets = cl::Buffer(context, CL_MEM_READ_WRITE, numBlocks * sizeof (cl_uint));
+
+	cl::Event huffmanLengthEvent;
+	cl::Kernel huffmanLengthKernel(program, "huffmanLengthKernel");
+	huffmanLengthKernel.setArg<cl::Buffer>(0, d_rleOutput);
+	huffmanLengthKernel.setArg<cl::Buffer>(1, d_pairOffsets);
+	huffmanLengthKernel.setArg<cl::Buffer>(2, d_pairCounts);
+	huffmanLengthKernel.setArg<cl::Buffer>(3, d_blockBits);
+	huffmanLengthKernel.setArg<cl::Buffer>(4, d_huffmanTables);
+	huffmanLengthKernel.setArg<cl_uint>(5, numMCUs);
+	huffmanLengthKernel.setArg<cl_uint>(6, mcusPerRow);
+	huffmanLengthKernel.setArg<cl_uint>(7, options.restartInterval);
+	queue.enqueueNDRangeKernel(huffmanLengthKernel, cl::NullRange, cl::NDRange(numMCUs, mcuBlocks), cl::NullRange, &huffmanWaitEvents, &huffmanLengthEvent);
+
+	// keep the lengths for the interval sizes, scan a copy into the offsets
+	std::vector<cl::Event> huffmanLengthDone(1, huffmanLengthEvent);
+	cl::Event blockBitsCopyEvent;
+	queue.enqueueCopyBuffer(d_blockBits, d_blockOffsets, 0, 0, numBlocks * sizeof (cl_uint), &huffmanLengthDone, &blockBitsCopyEvent);
+	std::vector<cl::Event> blockBitsCopyDone(1, blockBitsCopyEvent);
+	std::vector<cl::Event> scanEvents;
+	enqueueExclusiveScan(context, queue, exclusiveScanKernel, addGroupOffsetsKernel, d_blockOffsets, numBlocks, wgSizeScan, &blockBitsCopyDone, scanEvents);
+
+	// byte length of every restart interval (one interval without restart markers), scanned in place into
+	// byte offsets; the extra last entry receives the total size
+	unsigned int numIntervals = (options.restartInterval > 0) ? (numMCUs + options.restartInterval - 1) / options.restartInterval : 1;
+	cl::Buffer d_intervalOffsets = cl::Buffer(context, CL_MEM_READ_WRITE, (numIntervals + 1) * sizeof (cl_uint));
+	cl::Event intervalBytesEvent;
+	std::vector<cl::Event> blockOffsetsDone(1, scanEvents.back());
+	cl::Kernel restartIntervalBytesKernel(program, "restartIntervalBytesKernel");
+	restartIntervalBytesKernel.setArg<cl::Buffer>(0, d_blockOffsets);
+	restartIntervalBytesKernel.setArg<cl::Buffer>(1, d_blockBits);
+	restartIntervalBytesKernel.setArg<cl::Buffer>(2, d_intervalOffsets);
+	restartIntervalBytesKernel.setArg<cl_uint>(3, numMCUs);
+	restartIntervalBytesKernel.setArg<cl_uint>(4, options.restartInterval);
+	queue.enqueueNDRangeKernel(restartIntervalBytesKernel, cl::NullRange, cl::NDRange(numIntervals + 1), cl::NullRange, &blockOffsetsDone, &intervalBytesEvent);
+	std::vector<cl::Event> intervalBytesDone(1, intervalBytesEvent);
+	scanEvents.push_back(intervalBytesEvent);
+	enqueueExclusiveScan(context, queue, exclusiveScanKernel, addGroupOffsetsKernel, d_intervalOffsets, numIntervals + 1, wgSizeScan, &intervalBytesDone, scanEvents);
+
+	// the bit stream is allocated for the worst case, so its size is not needed before the scatter pass:
+	// a block takes at most a 16 bit DC code with 11 magnitude bits and 63 16 bit AC codes with 10 magnitude bits,
+	// every interval at most 7 bits of padding
+	size_t maxBlockBits = 16 + 11 + 63 * (16 + 10);
+	size_t maxWords = (numBlocks * maxBlockBits + numIntervals * 7 + 31) / 32;
+
+	// the bit stream is merged with atomic_or, so it starts zeroed; it lives in pinned host memory and is mapped
+	// for the JFIF output instead of being copied
+	cl::Buffer d_bitstream = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, maxWords * sizeof (cl_uint));
+	cl::Event bitstreamFillEvent;
+	queue.enqueueFillBuffer(d_bitstream, (cl_uint)0, 0, maxWords * sizeof (cl_uint), NULL, &bitstreamFillEvent);
+	std::vector<cl::Event> scatterWaitEvents(1, scanEvents.back());
+	scatterWaitEvents.push_back(bitstreamFillEvent);
+
+	cl::Event huffmanScatterEvent;
+	cl::Kernel huffmanScatterKernel(program, "huffmanScatterKernel");
+	huffmanScatterKernel.setArg<cl::Buffer>(0, d_rleOutput);
+	huffmanScatterKernel.setArg<cl::Buffer>(1, d_pairOffsets);
+	huffmanScatterKernel.setArg<cl::Buffer>(2, d_pairCounts);
+	huffmanScatterKernel.setArg<cl::Buffer>(3, d_blockOffsets);
+	huffmanScatterKernel.setArg<cl::Buffer>(4, d_intervalOffsets);
+	huffmanScatterKernel.setArg<cl::Buffer>(5, d_bitstream);
+	huffmanScatterKernel.setArg<cl::Buffer>(6, d_huffmanTables);
+	huffmanScatterKernel.setArg<cl_uint>(7, numMCUs);
+	huffmanScatterKernel.setArg<cl_uint>(8, mcusPerRow);
+	huffmanScatterKernel.setArg<cl_uint>(9, options.restartInterval);
+	queue.enqueueNDRangeKernel(huffmanScatterKernel, cl::NullRange, cl::NDRange(numMCUs, mcuBlocks), cl::NullRange, &scatterWaitEvents, &huffmanScatterEvent);
+
+	// Read the interval offsets (the last one is the total number of bytes) and map the packed bit stream into host memory
+	std::vector<cl::Event> huffmanScatterDone(1, huffmanScatterEvent);
+	std::vector<cl_uint> h_intervalOffsets(numIntervals + 1);
+	queue.enqueueReadBuffer(d_intervalOffsets, true, 0, (numIntervals + 1) * sizeof (cl_uint), h_intervalOffsets.data(), &huffmanScatterDone, NULL);
+	size_t totalBytes = h_intervalOffsets[numIntervals];
+	size_t numWords = std::max<size_t>((totalBytes + 3) / 4, 1);
+	const cl_uint *h_bitstream = (const cl_uint *)queue.enqueueMapBuffer(d_bitstream, CL_TRUE, CL_MAP_READ, 0, numWords * sizeof (cl_uint), &huffmanScatterDone, NULL);
 
 	// Wait for all commands to complete
 	queue.finish();
 
-	Core::TimeSpan rleTimeGPU = OpenCL::getElapsedTime(rleEvent);
-	std::cout << "RLE time (GPU): " << rleTimeGPU.toString() << std::endl;
+	///////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// Print performance data, the kernels are timed from their events after the whole chain has completed
+	Core::TimeSpan colorConversionTimeGPU = Core::TimeSpan::fromSeconds(0);
+	Core::TimeSpan DCTTimeGPU = Core::TimeSpan::fromSeconds(0);
+	Core::TimeSpan quantizationTimeGPU = Core::TimeSpan::fromSeconds(0);
+	Core::TimeSpan zigzagTimeGPU = Core::TimeSpan::fromSeconds(0);
+	Core::TimeSpan fusedTimeGPU = Core::TimeSpan::fromSeconds(0);
+	if (options.gpuPipeline == GPU_PIPELINE_FUSED) {
+		fusedTimeGPU = OpenCL::getElapsedTime(fusedEvent);
+		std::cout << "Fused MCU kernel time (GPU, " << (options.dctMethod == DCT_INT ? "int" : "tiled") << " DCT): " << fusedTimeGPU.toString() << std::endl;
+	} else {
+		colorConversionTimeGPU = OpenCL::getElapsedTime(colorConversionEvent);
+		if (grayscale) {
+			std::cout << "Level shift time (GPU, grayscale, no color conversion and chroma subsampling): " << colorConversionTimeGPU.toString() << std::endl;
+		} else {
+			std::cout << "Color conversion + chroma subsampling + level shift time (GPU): " << colorConversionTimeGPU.toString() << std::endl;
+		}
+		DCTTimeGPU = OpenCL::getElapsedTime(DCTEvent);
+		std::cout << "DCT time (GPU, " << (options.dctMethod == DCT_INT ? "int" : getGPUDCTKernelName(options.gpuDCTKernel)) << "): " << DCTTimeGPU.toString() << std::endl;
+		quantizationTimeGPU = OpenCL::getElapsedTime(quantizationEvent);
+		std::cout << "Quantization time (GPU): " << quantizationTimeGPU.toString() << std::endl;
+		zigzagTimeGPU = OpenCL::getElapsedTime(zigzagEvent);
+		std::cout << "ZigZag time (GPU): " << zigzagTimeGPU.toString() << std::endl;
+	}
+
+	Core::TimeSpan rleTimeGPU = OpenCL::getElapsedTime(rleCountEvent) + OpenCL::getElapsedTime(rleCompactEvent);
+	for (size_t i = 0; i < rleScanEvents.size(); i++) {
+		rleTimeGPU = rleTimeGPU + OpenCL::getElapsedTime(rleScanEvents[i]);
+	}
+	std::cout << "RLE time (GPU): " << rleTimeGPU.toString();
+	if (options.checkGPU) {
+		std::cout << " (" << numPairs << " pairs)";
+	}
+	std::cout << std::endl;
+
+	Core::TimeSpan huffmanHistogramTimeGPU = Core::TimeSpan::fromSeconds(0);
+	if (options.optimizeHuffman) {
+		huffmanHistogramTimeGPU = OpenCL::getElapsedTime(huffmanHistogramEvent);
+		std::cout << "Huffman histogram time (GPU): " << huffmanHistogramTimeGPU.toString() << std::endl;
+	}
+	Core::TimeSpan huffmanTimeGPU = huffmanHistogramTimeGPU + OpenCL::getElapsedTime(huffmanLengthEvent) + OpenCL::getElapsedTime(huffmanScatterEvent);
+	for (size_t i = 0; i < scanEvents.size(); i++) {
+		huffmanTimeGPU = huffmanTimeGPU + OpenCL::getElapsedTime(scanEvents[i]);
+	}
+	std::cout << "RLE + Huffman time (GPU): " << huffmanTimeGPU.toString() << " (" << totalBytes << " bytes, " << numIntervals << " restart intervals)" << std::endl;
+
+	//////////////////////////////////// JFIF File Output (GPU) ///////////////////////////////////////////
+
+	// the host only does the byte stuffing and inserts the restart markers between the padded intervals,
+	// the bytes are read in place from the mapped buffer
+	BitWriter scanDataGPU(newWidth * newHeight);
+	writeBitstreamWords(h_bitstream, h_intervalOffsets.data(), numIntervals, scanDataGPU);
+	queue.enqueueUnmapMemObject(d_bitstream, (void *)h_bitstream);
+	h_bitstream = NULL;
+
+	// check the bit stream of the GPU against the host encoder with the same coefficients and tables
+	if (options.checkGPU) {
+		BitWriter scanDataHost(newWidth * newHeight);
+		ThreadPool pool(options.numThreads);
+		coeff_image_t zigzagCoeffs = { newWidth, newHeight, subsamplingX, subsamplingY, numComponents, zigzagOutput.data() };
+		performEntropyCodingZigZag(&zigzagCoeffs, scanDataHost, options.restartInterval, &pool, &huffmanTablesGPU);
+		if (scanDataGPU.size() != scanDataHost.size() || memcmp(scanDataGPU.data(), scanDataHost.data(), scanDataHost.size()) != 0) {
+			std::cout << "Error: the bit stream of the GPU differs from the host encoder" << std::endl;
+			return 1;
+		}
+		std::cout << "Bit stream of the GPU matches the host encoder" << std::endl;
+	}
+
+	JFIFHeader jfifHeaderGPU = { imgCPU.width, imgCPU.height, quant_mat_lum, quant_mat_chrom, numComponents, subsamplingX, subsamplingY, options.restartInterval, &huffmanTablesGPU };
+	std::vector<uint8_t> jpegGPU(getJFIFFileSize(jfifHeaderGPU, scanDataGPU.size()));
+	size_t jpegSizeGPU = writeJFIF(jpegGPU.data(), jpegGPU.size(), jfifHeaderGPU, scanDataGPU.data(), scanDataGPU.size());
+	std::cout << "JPEG file size (GPU): " << jpegSizeGPU << " bytes" << std::endl;
+
+	if (writeJPEGImage("../data/fruitGPU.jpg", jpegGPU.data(), jpegSizeGPU) == -1) {
+		std::cout << "Error writing the image" << std::endl;
+		return 1;
+	}
 
 	///////////////////////////////////////////////////////////////////////////////////////////////////////
 	
 	
 	// Calculate speedups for all steps
 	std::cout << "\n## Speedups: ##" << std::endl;
-	std::cout << "Color conversion: " << (cpu_telemetry.CSCTime / static_cast<double>(colorConversionTimeGPU.getMicroseconds())) << std::endl;
-	std::cout << "Chroma subsampling: " << (cpu_telemetry.CDSTime / static_cast<double>(chromaSubsamplingTimeGPU.getMicroseconds())) << std::endl;
-	std::cout << "Level shifting: " << (cpu_telemetry.levelShiftTime / static_cast<double>(LevelShiftTimeGPU.getMicroseconds())) << std::endl;
-	std::cout << "DCT: " << (cpu_telemetry.DCTTime / static_cast<double>(DCTTimeGPU.getMicroseconds())) << std::endl;
-	std::cout << "Quantization: " << (cpu_telemetry.QuantTime / static_cast<double>(quantizationTimeGPU.getMicroseconds())) << std::endl;
-	std::cout << "ZigZag: " << (cpu_telemetry.zigZagTime / static_cast<double>(zigzagTimeGPU.getMicroseconds())) << std::endl;
-	std::cout << "RLE: " << (cpu_telemetry.RLETime / static_cast<double>(rleTimeGPU.getMicroseconds())) << std::endl;
+	if (options.gpuPipeline == GPU_PIPELINE_FUSED) {
+		// the zigzag scan of the CPU is part of its entropy coding
+		std::cout << "Color conversion + DCT + Quantization (fused): " << ((cpu_telemetry.CSCTime + cpu_telemetry.CDSTime + cpu_telemetry.levelShiftTime + cpu_telemetry.DCTTime + cpu_telemetry.QuantTime) / static_cast<double>(fusedTimeGPU.getMicroseconds())) << std::endl;
+	} else {
+		// both sides fuse the color conversion, chroma subsampling and level shifting into one stage
+		std::cout << "Color conversion + chroma subsampling + level shifting: " << ((cpu_telemetry.CSCTime + cpu_telemetry.CDSTime + cpu_telemetry.levelShiftTime) / static_cast<double>(colorConversionTimeGPU.getMicroseconds())) << std::endl;
+		// the CPU quantizes in the DCT pass
+		std::cout << "DCT + Quantization: " << ((cpu_telemetry.DCTTime + cpu_telemetry.QuantTime) / static_cast<double>((DCTTimeGPU + quantizationTimeGPU).getMicroseconds())) << std::endl;
+	}
+	std::cout << "Entropy coding (ZigZag + RLE + Huffman): " << (cpu_telemetry.entropyCodingTime / static_cast<double>((zigzagTimeGPU + huffmanTimeGPU).getMicroseconds())) << std::endl;
 
 
 	return 0;
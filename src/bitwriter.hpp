@@ -0,0 +1,119 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+// Packed bit writer for the entropy-coded segment of the JPEG stream.
+// Bits are collected MSB-first in a 64-bit accumulator and flushed in 32-bit words
+// into a byte buffer that is reused across encodes. Every 0xFF byte written is followed
+// by a stuffed 0x00 byte as required by the JPEG standard (B.1.1.5), unless stuffing is
+// disabled for partial streams that are stitched together and stuffed afterwards.
+class BitWriter {
+public:
+	explicit BitWriter(size_t reserveBytes = 4096, bool stuffBytes = true) : m_acc(0), m_accBits(0), m_pos(0), m_stuffBytes(stuffBytes) {
+		m_buffer.resize(reserveBytes < 64 ? 64 : reserveBytes);
+	}
+
+	// Reset the writer, keeping the allocated buffer
+	void clear() {
+		m_acc = 0;
+		m_accBits = 0;
+		m_pos = 0;
+	}
+
+	// Append the lowest 'length' bits of 'bits' (length <= 32, bits must not exceed 'length' bits)
+	inline void writeBits(uint32_t bits, unsigned int length) {
+		m_acc = (m_acc << length) | bits;
+		m_accBits += length;
+		if (m_accBits >= 32) {
+			flushWord();
+		}
+	}
+
+	// Pad the last byte with 1-bits and write all remaining bits to the buffer
+	void flush() {
+		unsigned int pad = (8 - (m_accBits & 7)) & 7;
+		if (pad) {
+			m_acc = (m_acc << pad) | ((1u << pad) - 1);
+			m_accBits += pad;
+		}
+		reserve(8);
+		while (m_accBits >= 8) {
+			m_accBits -= 8;
+			putByte((uint8_t)(m_acc >> m_accBits));
+		}
+	}
+
+	// Append bytes that are already byte stuffed (e.g. another flushed writer), call flush() first
+	void writeBytes(const uint8_t *bytes, size_t count) {
+		memcpy(appendBytes(count), bytes, count);
+	}
+
+	// Append a marker (0xFF followed by 'marker') without stuffing, call flush() first
+	void writeMarker(uint8_t marker) {
+		reserve(2);
+		m_buffer[m_pos++] = 0xFF;
+		m_buffer[m_pos++] = marker;
+	}
+
+	// Reserve 'count' bytes at the end of the buffer and return a pointer to them
+	// The caller fills them with already stuffed data, call flush() first
+	uint8_t* appendBytes(size_t count) {
+		reserve(count);
+		uint8_t *out = m_buffer.data() + m_pos;
+		m_pos += count;
+		return out;
+	}
+
+	// Number of bits written so far, before padding (only exact without byte stuffing)
+	size_t bitCount() const { return m_pos * 8 + m_accBits; }
+
+	// Pointer to the encoded bytes (valid until the next write)
+	const uint8_t* data() const { return m_buffer.data(); }
+	// Number of encoded bytes written so far (including stuffed bytes)
+	size_t size() const { return m_pos; }
+
+private:
+	uint64_t m_acc;
+	unsigned int m_accBits;
+	std::vector<uint8_t> m_buffer;
+	size_t m_pos;
+	bool m_stuffBytes;
+
+	// Make sure that at least 'bytes' more bytes fit into the buffer
+	inline void reserve(size_t bytes) {
+		if (m_pos + bytes > m_buffer.size()) {
+			m_buffer.resize(2 * m_buffer.size() + bytes);
+		}
+	}
+
+	inline void putByte(uint8_t byte) {
+		m_buffer[m_pos++] = byte;
+		if (byte == 0xFF && m_stuffBytes) {
+			m_buffer[m_pos++] = 0x00;
+		}
+	}
+
+	// Move the upper 32 pending bits of the accumulator into the buffer
+	inline void flushWord() {
+		m_accBits -= 32;
+		uint32_t word = (uint32_t)(m_acc >> m_accBits);
+		reserve(8);
+		// fast path: no 0xFF byte in the word, so no stuffing is needed
+		uint32_t inv = ~word;
+		if (!m_stuffBytes || ((inv - 0x01010101u) & ~inv & 0x80808080u) == 0) {
+			uint8_t *out = m_buffer.data() + m_pos;
+			out[0] = (uint8_t)(word >> 24);
+			out[1] = (uint8_t)(word >> 16);
+			out[2] = (uint8_t)(word >> 8);
+			out[3] = (uint8_t)word;
+			m_pos += 4;
+		} else {
+			putByte((uint8_t)(word >> 24));
+			putByte((uint8_t)(word >> 16));
+			putByte((uint8_t)(word >> 8));
+			putByte((uint8_t)word);
+		}
+	}
+};
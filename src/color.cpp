@@ -0,0 +1,198 @@
+#include "color.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CSC_X86 1
+#include <immintrin.h>
+#endif
+
+// GCC and Clang only allow the intrinsics in functions compiled for the instruction set,
+// MSVC allows them everywhere
+#if defined(__GNUC__)
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE41
+#define TARGET_AVX2
+#endif
+
+// conversion constants: round(x * 2^14), the three constants of every channel add up to 2^14 (Y) or 0 (Cb, Cr)
+#define CSC_Y_R   4899  //  0.299
+#define CSC_Y_G   9617  //  0.587
+#define CSC_Y_B   1868  //  0.114
+#define CSC_CB_R -2765  // -0.168736
+#define CSC_CB_G -5427  // -0.331264
+#define CSC_CB_B  8192  //  0.5
+#define CSC_CR_R  8192  //  0.5
+#define CSC_CR_G -6860  // -0.418688
+#define CSC_CR_B -1332  // -0.081312
+
+// rounding plus level shift: Y loses its 128, the +128 of Cb and Cr cancels with the level shift
+#define CSC_Y_OFFSET ((1 << (CSC_FIX_BITS - 1)) - (128 << CSC_FIX_BITS))
+#define CSC_C_OFFSET (1 << (CSC_FIX_BITS - 1))
+
+///////////////////////////////////////// Scalar /////////////////////////////////////////////////
+
+// Function to descale a fixed-point sample and saturate it to -128..127
+static inline int8_t descaleSample(int x) {
+	x >>= CSC_FIX_BITS;
+	return (int8_t)(x < -128 ? -128 : (x > 127 ? 127 : x));
+}
+
+static void performCSCScalar(const uint8_t *rgb, int8_t *y, int8_t *cb, int8_t *cr, size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		int r = rgb[3 * i];
+		int g = rgb[3 * i + 1];
+		int b = rgb[3 * i + 2];
+		y[i] = descaleSample(CSC_Y_R * r + CSC_Y_G * g + CSC_Y_B * b + CSC_Y_OFFSET);
+		cb[i] = descaleSample(CSC_CB_R * r + CSC_CB_G * g + CSC_CB_B * b + CSC_C_OFFSET);
+		cr[i] = descaleSample(CSC_CR_R * r + CSC_CR_G * g + CSC_CR_B * b + CSC_C_OFFSET);
+	}
+}
+
+#if defined(CSC_X86)
+
+///////////////////////////////////////// SSE4.1 /////////////////////////////////////////////////
+
+// Function to split 16 interleaved RGB pixels (48 bytes) into 16 R, 16 G and 16 B values
+// Every output byte is picked from one of the three loads with pshufb, the others give zero (-1)
+static TARGET_SSE41 inline void deinterleaveRGBSSE41(const uint8_t *rgb, __m128i *r, __m128i *g, __m128i *b) {
+	__m128i in0 = _mm_loadu_si128((const __m128i *)rgb);
+	__m128i in1 = _mm_loadu_si128((const __m128i *)(rgb + 16));
+	__m128i in2 = _mm_loadu_si128((const __m128i *)(rgb + 32));
+
+	*r = _mm_or_si128(_mm_or_si128(
+		_mm_shuffle_epi8(in0, _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+		_mm_shuffle_epi8(in1, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1))),
+		_mm_shuffle_epi8(in2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13)));
+	*g = _mm_or_si128(_mm_or_si128(
+		_mm_shuffle_epi8(in0, _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+		_mm_shuffle_epi8(in1, _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1))),
+		_mm_shuffle_epi8(in2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14)));
+	*b = _mm_or_si128(_mm_or_si128(
+		_mm_shuffle_epi8(in0, _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+		_mm_shuffle_epi8(in1, _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1))),
+		_mm_shuffle_epi8(in2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15)));
+}
+
+// Function to get a pair of 16-bit constants for pmaddwd
+static TARGET_SSE41 inline __m128i constantPairSSE41(int first, int second) {
+	return _mm_set1_epi32((int)(((uint32_t)(uint16_t)second << 16) | (uint16_t)first));
+}
+
+// Function to convert 8 pixels of one channel: rg holds interleaved 16-bit R, G values, b0 B values
+// interleaved with zeros. Gives the descaled samples as 16-bit values.
+static TARGET_SSE41 inline __m128i convertChannelSSE41(__m128i rgLo, __m128i rgHi, __m128i b0Lo, __m128i b0Hi, __m128i coefRG, __m128i coefB, __m128i offset) {
+	__m128i lo = _mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(rgLo, coefRG), _mm_madd_epi16(b0Lo, coefB)), offset);
+	__m128i hi = _mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(rgHi, coefRG), _mm_madd_epi16(b0Hi, coefB)), offset);
+	return _mm_packs_epi32(_mm_srai_epi32(lo, CSC_FIX_BITS), _mm_srai_epi32(hi, CSC_FIX_BITS));
+}
+
+static TARGET_SSE41 void performCSCSSE41(const uint8_t *rgb, int8_t *y, int8_t *cb, int8_t *cr, size_t count) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i coefYRG = constantPairSSE41(CSC_Y_R, CSC_Y_G);
+	const __m128i coefYB = constantPairSSE41(CSC_Y_B, 0);
+	const __m128i coefCbRG = constantPairSSE41(CSC_CB_R, CSC_CB_G);
+	const __m128i coefCbB = constantPairSSE41(CSC_CB_B, 0);
+	const __m128i coefCrRG = constantPairSSE41(CSC_CR_R, CSC_CR_G);
+	const __m128i coefCrB = constantPairSSE41(CSC_CR_B, 0);
+	const __m128i offsetY = _mm_set1_epi32(CSC_Y_OFFSET);
+	const __m128i offsetC = _mm_set1_epi32(CSC_C_OFFSET);
+
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		__m128i r, g, b;
+		deinterleaveRGBSSE41(rgb + 3 * i, &r, &g, &b);
+
+		__m128i outY[2], outCb[2], outCr[2];
+		for (int h = 0; h < 2; ++h) {
+			// 8 pixels at a time as 16-bit values
+			__m128i r16 = h ? _mm_unpackhi_epi8(r, zero) : _mm_cvtepu8_epi16(r);
+			__m128i g16 = h ? _mm_unpackhi_epi8(g, zero) : _mm_cvtepu8_epi16(g);
+			__m128i b16 = h ? _mm_unpackhi_epi8(b, zero) : _mm_cvtepu8_epi16(b);
+			__m128i rgLo = _mm_unpacklo_epi16(r16, g16);
+			__m128i rgHi = _mm_unpackhi_epi16(r16, g16);
+			__m128i b0Lo = _mm_unpacklo_epi16(b16, zero);
+			__m128i b0Hi = _mm_unpackhi_epi16(b16, zero);
+			outY[h] = convertChannelSSE41(rgLo, rgHi, b0Lo, b0Hi, coefYRG, coefYB, offsetY);
+			outCb[h] = convertChannelSSE41(rgLo, rgHi, b0Lo, b0Hi, coefCbRG, coefCbB, offsetC);
+			outCr[h] = convertChannelSSE41(rgLo, rgHi, b0Lo, b0Hi, coefCrRG, coefCrB, offsetC);
+		}
+		// saturate to 8 bits
+		_mm_storeu_si128((__m128i *)(y + i), _mm_packs_epi16(outY[0], outY[1]));
+		_mm_storeu_si128((__m128i *)(cb + i), _mm_packs_epi16(outCb[0], outCb[1]));
+		_mm_storeu_si128((__m128i *)(cr + i), _mm_packs_epi16(outCr[0], outCr[1]));
+	}
+	performCSCScalar(rgb + 3 * i, y + i, cb + i, cr + i, count - i);
+}
+
+///////////////////////////////////////// AVX2 ///////////////////////////////////////////////////
+
+// Function to convert 16 pixels of one channel (see convertChannelSSE41)
+// The unpack and pack instructions work within 128-bit lanes, so the pixels stay in order
+static TARGET_AVX2 inline __m256i convertChannelAVX2(__m256i rgLo, __m256i rgHi, __m256i b0Lo, __m256i b0Hi, __m256i coefRG, __m256i coefB, __m256i offset) {
+	__m256i lo = _mm256_add_epi32(_mm256_add_epi32(_mm256_madd_epi16(rgLo, coefRG), _mm256_madd_epi16(b0Lo, coefB)), offset);
+	__m256i hi = _mm256_add_epi32(_mm256_add_epi32(_mm256_madd_epi16(rgHi, coefRG), _mm256_madd_epi16(b0Hi, coefB)), offset);
+	return _mm256_packs_epi32(_mm256_srai_epi32(lo, CSC_FIX_BITS), _mm256_srai_epi32(hi, CSC_FIX_BITS));
+}
+
+// Function to get a pair of 16-bit constants for vpmaddwd
+static TARGET_AVX2 inline __m256i constantPairAVX2(int first, int second) {
+	return _mm256_set1_epi32((int)(((uint32_t)(uint16_t)second << 16) | (uint16_t)first));
+}
+
+static TARGET_AVX2 void performCSCAVX2(const uint8_t *rgb, int8_t *y, int8_t *cb, int8_t *cr, size_t count) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i coefYRG = constantPairAVX2(CSC_Y_R, CSC_Y_G);
+	const __m256i coefYB = constantPairAVX2(CSC_Y_B, 0);
+	const __m256i coefCbRG = constantPairAVX2(CSC_CB_R, CSC_CB_G);
+	const __m256i coefCbB = constantPairAVX2(CSC_CB_B, 0);
+	const __m256i coefCrRG = constantPairAVX2(CSC_CR_R, CSC_CR_G);
+	const __m256i coefCrB = constantPairAVX2(CSC_CR_B, 0);
+	const __m256i offsetY = _mm256_set1_epi32(CSC_Y_OFFSET);
+	const __m256i offsetC = _mm256_set1_epi32(CSC_C_OFFSET);
+
+	size_t i = 0;
+	for (; i + 32 <= count; i += 32) {
+		__m256i outY[2], outCb[2], outCr[2];
+		for (int h = 0; h < 2; ++h) {
+			// pshufb does not cross 128-bit lanes, so 16 pixels are split with the SSE shuffles
+			__m128i r, g, b;
+			deinterleaveRGBSSE41(rgb + 3 * (i + 16 * h), &r, &g, &b);
+
+			__m256i r16 = _mm256_cvtepu8_epi16(r);
+			__m256i g16 = _mm256_cvtepu8_epi16(g);
+			__m256i b16 = _mm256_cvtepu8_epi16(b);
+			__m256i rgLo = _mm256_unpacklo_epi16(r16, g16);
+			__m256i rgHi = _mm256_unpackhi_epi16(r16, g16);
+			__m256i b0Lo = _mm256_unpacklo_epi16(b16, zero);
+			__m256i b0Hi = _mm256_unpackhi_epi16(b16, zero);
+			outY[h] = convertChannelAVX2(rgLo, rgHi, b0Lo, b0Hi, coefYRG, coefYB, offsetY);
+			outCb[h] = convertChannelAVX2(rgLo, rgHi, b0Lo, b0Hi, coefCbRG, coefCbB, offsetC);
+			outCr[h] = convertChannelAVX2(rgLo, rgHi, b0Lo, b0Hi, coefCrRG, coefCrB, offsetC);
+		}
+		// saturate to 8 bits, the lane-wise pack gives the quarters in the order 0, 2, 1, 3
+		_mm256_storeu_si256((__m256i *)(y + i), _mm256_permute4x64_epi64(_mm256_packs_epi16(outY[0], outY[1]), 0xD8));
+		_mm256_storeu_si256((__m256i *)(cb + i), _mm256_permute4x64_epi64(_mm256_packs_epi16(outCb[0], outCb[1]), 0xD8));
+		_mm256_storeu_si256((__m256i *)(cr + i), _mm256_permute4x64_epi64(_mm256_packs_epi16(outCr[0], outCr[1]), 0xD8));
+	}
+	performCSCScalar(rgb + 3 * i, y + i, cb + i, cr + i, count - i);
+}
+
+#endif
+
+///////////////////////////////////////// Dispatch ///////////////////////////////////////////////
+
+// Function to get the color conversion for an instruction set (the level must be supported by the CPU)
+CSCFunc getCSCFunc(SimdLevel level) {
+#ifdef CSC_X86
+	switch (level) {
+	case SIMD_AVX2:
+		return performCSCAVX2;
+	case SIMD_SSE41:
+		return performCSCSSE41;
+	default:
+		break;
+	}
+#endif
+	return performCSCScalar;
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "dct.hpp"
+
+// Fixed-point RGB to YCbCr conversion of the CPU path with the level shift folded in.
+// The scalar, SSE4.1 and AVX2 versions are compiled into the same binary and picked at runtime
+// (see detectSimdLevel); they give identical results.
+
+// fixed-point constants of the conversion: round(x * 2^14), so the products of two of them with
+// 8-bit samples can be added up with one pmaddwd
+#define CSC_FIX_BITS 14
+
+// Conversion of count interleaved RGB pixels into planar, level shifted Y, Cb and Cr samples:
+// Y - 128, Cb - 128 and Cr - 128 of the JFIF conversion, rounded and saturated to -128..127
+typedef void (*CSCFunc)(const uint8_t *rgb, int8_t *y, int8_t *cb, int8_t *cr, size_t count);
+
+CSCFunc getCSCFunc(SimdLevel);
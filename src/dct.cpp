@@ -0,0 +1,662 @@
+#include "dct.hpp"
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define DCT_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang only allow the intrinsics in functions compiled for the instruction set,
+// MSVC allows them everywhere
+#if defined(__GNUC__)
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE41
+#define TARGET_AVX2
+#endif
+
+const double aanScaleFactor[8] = {
+	1.0, 1.3870398453221475, 1.3065629648763766, 1.1758756024193588,
+	1.0, 0.78569495838710235, 0.54119610014619712, 0.27589937928294311
+};
+
+// AAN multipliers
+#define AAN_C4   0.70710678118654757f // cos(4 pi / 16)
+#define AAN_C6   0.38268343236508984f // cos(6 pi / 16)
+#define AAN_C2M6 0.54119610014619690f // cos(2 pi / 16) - cos(6 pi / 16)
+#define AAN_C2P6 1.30656296487637660f // cos(2 pi / 16) + cos(6 pi / 16)
+
+// Function to get the multipliers of the DCT kernels: AAN descaling divided by the quantization matrix
+// With quant = NULL only the descaling is applied, which gives the coefficients of performDCT
+void getDCTQuantScale(const unsigned int quant[8][8], float scale[64]) {
+	for (size_t v = 0; v < 8; ++v) {
+		for (size_t u = 0; u < 8; ++u) {
+			double q = quant ? (double)quant[v][u] : 1.0;
+			scale[v * 8 + u] = (float)(1.0 / (8.0 * aanScaleFactor[u] * aanScaleFactor[v] * q));
+		}
+	}
+}
+
+// Function to get the basis matrix of the 1-D DCT, matrix[u * 8 + x] = alpha(u) / 2 * cos((2x + 1) u pi / 16)
+// A row pass and a column pass with it give the coefficients of performDCT (used by the GPU DCTTiledKernel)
+void getDCTMatrix(float matrix[64]) {
+	for (size_t u = 0; u < 8; ++u) {
+		double alpha = (u == 0) ? std::sqrt(0.125) : 0.5;
+		for (size_t x = 0; x < 8; ++x) {
+			matrix[u * 8 + x] = (float)(alpha * std::cos((2 * x + 1) * u * M_PI / 16.0));
+		}
+	}
+}
+
+// fixed-point constants of the integer DCT: round(x * 2^13)
+#define INT_CONST_BITS 13
+#define INT_PASS1_BITS 2
+#define FIX_0_298631336  2446
+#define FIX_0_390180644  3196
+#define FIX_0_541196100  4433
+#define FIX_0_765366865  6270
+#define FIX_0_899976223  7373
+#define FIX_1_175875602  9633
+#define FIX_1_501321110 12299
+#define FIX_1_847759065 15137
+#define FIX_1_961570560 16069
+#define FIX_2_053119869 16819
+#define FIX_2_562915447 20995
+#define FIX_3_072711026 25172
+
+// the rows are scaled up by 2^PASS1_BITS for precision, the columns remove that scaling again
+#define INT_DESCALE_PASS1 (INT_CONST_BITS - INT_PASS1_BITS)
+#define INT_DESCALE_PASS2 (INT_CONST_BITS + INT_PASS1_BITS)
+
+///////////////////////////////////////// Scalar /////////////////////////////////////////////////
+
+// Function to perform the 1-D AAN DCT on 8 values with the given stride
+static inline void performAAN1DScalar(float *d, size_t stride) {
+	float tmp0 = d[0 * stride] + d[7 * stride];
+	float tmp7 = d[0 * stride] - d[7 * stride];
+	float tmp1 = d[1 * stride] + d[6 * stride];
+	float tmp6 = d[1 * stride] - d[6 * stride];
+	float tmp2 = d[2 * stride] + d[5 * stride];
+	float tmp5 = d[2 * stride] - d[5 * stride];
+	float tmp3 = d[3 * stride] + d[4 * stride];
+	float tmp4 = d[3 * stride] - d[4 * stride];
+
+	// even part
+	float tmp10 = tmp0 + tmp3;
+	float tmp13 = tmp0 - tmp3;
+	float tmp11 = tmp1 + tmp2;
+	float tmp12 = tmp1 - tmp2;
+
+	d[0 * stride] = tmp10 + tmp11;
+	d[4 * stride] = tmp10 - tmp11;
+
+	float z1 = (tmp12 + tmp13) * AAN_C4;
+	d[2 * stride] = tmp13 + z1;
+	d[6 * stride] = tmp13 - z1;
+
+	// odd part
+	tmp10 = tmp4 + tmp5;
+	tmp11 = tmp5 + tmp6;
+	tmp12 = tmp6 + tmp7;
+
+	float z5 = (tmp10 - tmp12) * AAN_C6;
+	float z2 = AAN_C2M6 * tmp10 + z5;
+	float z4 = AAN_C2P6 * tmp12 + z5;
+	float z3 = tmp11 * AAN_C4;
+
+	float z11 = tmp7 + z3;
+	float z13 = tmp7 - z3;
+
+	d[5 * stride] = z13 + z2;
+	d[3 * stride] = z13 - z2;
+	d[1 * stride] = z11 + z4;
+	d[7 * stride] = z11 - z4;
+}
+
+static void performDCTQuantBlockScalar(const float *block, float *coeffs, const float *scale, bool roundOutput) {
+	float tmp[64];
+	for (size_t i = 0; i < 64; ++i) {
+		tmp[i] = block[i];
+	}
+	// columns, then rows: the same order of operations as the SIMD versions, so they give the same coefficients
+	for (size_t i = 0; i < 8; ++i) {
+		performAAN1DScalar(&tmp[i], 8);
+	}
+	for (size_t i = 0; i < 8; ++i) {
+		performAAN1DScalar(&tmp[i * 8], 1);
+	}
+	for (size_t i = 0; i < 64; ++i) {
+		coeffs[i] = roundOutput ? std::round(tmp[i] * scale[i]) : tmp[i] * scale[i];
+	}
+}
+
+// Function to shift right with rounding
+static inline int descaleInt(int x, int n) {
+	return (x + (1 << (n - 1))) >> n;
+}
+
+// Function to perform the 1-D integer DCT on 8 values with the given stride
+// The rows (first pass) and the columns (second pass) only differ in the scaling of the outputs
+static inline void performDCTInt1DScalar(int *d, size_t stride, bool firstPass) {
+	int descale = firstPass ? INT_DESCALE_PASS1 : INT_DESCALE_PASS2;
+
+	int tmp0 = d[0 * stride] + d[7 * stride];
+	int tmp7 = d[0 * stride] - d[7 * stride];
+	int tmp1 = d[1 * stride] + d[6 * stride];
+	int tmp6 = d[1 * stride] - d[6 * stride];
+	int tmp2 = d[2 * stride] + d[5 * stride];
+	int tmp5 = d[2 * stride] - d[5 * stride];
+	int tmp3 = d[3 * stride] + d[4 * stride];
+	int tmp4 = d[3 * stride] - d[4 * stride];
+
+	// even part
+	int tmp10 = tmp0 + tmp3;
+	int tmp13 = tmp0 - tmp3;
+	int tmp11 = tmp1 + tmp2;
+	int tmp12 = tmp1 - tmp2;
+
+	if (firstPass) {
+		d[0 * stride] = (tmp10 + tmp11) * (1 << INT_PASS1_BITS);
+		d[4 * stride] = (tmp10 - tmp11) * (1 << INT_PASS1_BITS);
+	} else {
+		d[0 * stride] = descaleInt(tmp10 + tmp11, INT_PASS1_BITS);
+		d[4 * stride] = descaleInt(tmp10 - tmp11, INT_PASS1_BITS);
+	}
+
+	int z1 = (tmp12 + tmp13) * FIX_0_541196100;
+	d[2 * stride] = descaleInt(z1 + tmp13 * FIX_0_765366865, descale);
+	d[6 * stride] = descaleInt(z1 - tmp12 * FIX_1_847759065, descale);
+
+	// odd part
+	z1 = tmp4 + tmp7;
+	int z2 = tmp5 + tmp6;
+	int z3 = tmp4 + tmp6;
+	int z4 = tmp5 + tmp7;
+	int z5 = (z3 + z4) * FIX_1_175875602;
+
+	tmp4 = tmp4 * FIX_0_298631336;
+	tmp5 = tmp5 * FIX_2_053119869;
+	tmp6 = tmp6 * FIX_3_072711026;
+	tmp7 = tmp7 * FIX_1_501321110;
+	z1 = z1 * -FIX_0_899976223;
+	z2 = z2 * -FIX_2_562915447;
+	z3 = z3 * -FIX_1_961570560 + z5;
+	z4 = z4 * -FIX_0_390180644 + z5;
+
+	d[7 * stride] = descaleInt(tmp4 + z1 + z3, descale);
+	d[5 * stride] = descaleInt(tmp5 + z2 + z4, descale);
+	d[3 * stride] = descaleInt(tmp6 + z2 + z3, descale);
+	d[1 * stride] = descaleInt(tmp7 + z1 + z4, descale);
+}
+
+static void performDCTIntBlockScalar(const int *block, int *coeffs) {
+	for (size_t i = 0; i < 64; ++i) {
+		coeffs[i] = block[i];
+	}
+	for (size_t i = 0; i < 8; ++i) {
+		performDCTInt1DScalar(&coeffs[i * 8], 1, true);
+	}
+	for (size_t i = 0; i < 8; ++i) {
+		performDCTInt1DScalar(&coeffs[i], 8, false);
+	}
+}
+
+#ifdef DCT_X86
+
+///////////////////////////////////////// SSE4.1 /////////////////////////////////////////////////
+
+// Function to perform the 1-D AAN DCT across 8 vectors, i.e. on 4 columns at once
+static TARGET_SSE41 inline void performAAN1DSSE41(__m128 *d) {
+	__m128 tmp0 = _mm_add_ps(d[0], d[7]);
+	__m128 tmp7 = _mm_sub_ps(d[0], d[7]);
+	__m128 tmp1 = _mm_add_ps(d[1], d[6]);
+	__m128 tmp6 = _mm_sub_ps(d[1], d[6]);
+	__m128 tmp2 = _mm_add_ps(d[2], d[5]);
+	__m128 tmp5 = _mm_sub_ps(d[2], d[5]);
+	__m128 tmp3 = _mm_add_ps(d[3], d[4]);
+	__m128 tmp4 = _mm_sub_ps(d[3], d[4]);
+
+	// even part
+	__m128 tmp10 = _mm_add_ps(tmp0, tmp3);
+	__m128 tmp13 = _mm_sub_ps(tmp0, tmp3);
+	__m128 tmp11 = _mm_add_ps(tmp1, tmp2);
+	__m128 tmp12 = _mm_sub_ps(tmp1, tmp2);
+
+	d[0] = _mm_add_ps(tmp10, tmp11);
+	d[4] = _mm_sub_ps(tmp10, tmp11);
+
+	__m128 z1 = _mm_mul_ps(_mm_add_ps(tmp12, tmp13), _mm_set1_ps(AAN_C4));
+	d[2] = _mm_add_ps(tmp13, z1);
+	d[6] = _mm_sub_ps(tmp13, z1);
+
+	// odd part
+	tmp10 = _mm_add_ps(tmp4, tmp5);
+	tmp11 = _mm_add_ps(tmp5, tmp6);
+	tmp12 = _mm_add_ps(tmp6, tmp7);
+
+	__m128 z5 = _mm_mul_ps(_mm_sub_ps(tmp10, tmp12), _mm_set1_ps(AAN_C6));
+	__m128 z2 = _mm_add_ps(_mm_mul_ps(tmp10, _mm_set1_ps(AAN_C2M6)), z5);
+	__m128 z4 = _mm_add_ps(_mm_mul_ps(tmp12, _mm_set1_ps(AAN_C2P6)), z5);
+	__m128 z3 = _mm_mul_ps(tmp11, _mm_set1_ps(AAN_C4));
+
+	__m128 z11 = _mm_add_ps(tmp7, z3);
+	__m128 z13 = _mm_sub_ps(tmp7, z3);
+
+	d[5] = _mm_add_ps(z13, z2);
+	d[3] = _mm_sub_ps(z13, z2);
+	d[1] = _mm_add_ps(z11, z4);
+	d[7] = _mm_sub_ps(z11, z4);
+}
+
+// Function to transpose an 8x8 block held as left (columns 0-3) and right (columns 4-7) halves of the rows
+static TARGET_SSE41 inline void transpose8x8SSE41(__m128 *left, __m128 *right) {
+	_MM_TRANSPOSE4_PS(left[0], left[1], left[2], left[3]);
+	_MM_TRANSPOSE4_PS(right[0], right[1], right[2], right[3]);
+	_MM_TRANSPOSE4_PS(left[4], left[5], left[6], left[7]);
+	_MM_TRANSPOSE4_PS(right[4], right[5], right[6], right[7]);
+	// swap the off-diagonal 4x4 blocks
+	for (size_t i = 0; i < 4; ++i) {
+		__m128 tmp = right[i];
+		right[i] = left[i + 4];
+		left[i + 4] = tmp;
+	}
+}
+
+// Function to round to the nearest integer with halfway cases away from zero (exactly like std::round)
+// x + 0.5 is not exact in single precision (0.49999997f would round up), so the integer part is
+// truncated and incremented in magnitude if the exact fraction is at least one half
+static TARGET_SSE41 inline __m128 roundSSE41(__m128 x) {
+	__m128 sign = _mm_and_ps(x, _mm_set1_ps(-0.0f));
+	__m128 integer = _mm_round_ps(x, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+	__m128 fraction = _mm_andnot_ps(_mm_set1_ps(-0.0f), _mm_sub_ps(x, integer));
+	__m128 carry = _mm_and_ps(_mm_cmpge_ps(fraction, _mm_set1_ps(0.5f)), _mm_or_ps(_mm_set1_ps(1.0f), sign));
+	return _mm_add_ps(integer, carry);
+}
+
+static TARGET_SSE41 void performDCTQuantBlockSSE41(const float *block, float *coeffs, const float *scale, bool roundOutput) {
+	__m128 left[8], right[8];
+	for (size_t i = 0; i < 8; ++i) {
+		left[i] = _mm_loadu_ps(block + i * 8);
+		right[i] = _mm_loadu_ps(block + i * 8 + 4);
+	}
+
+	// columns, transpose, rows (now held as columns), transpose back
+	performAAN1DSSE41(left);
+	performAAN1DSSE41(right);
+	transpose8x8SSE41(left, right);
+	performAAN1DSSE41(left);
+	performAAN1DSSE41(right);
+	transpose8x8SSE41(left, right);
+
+	for (size_t i = 0; i < 8; ++i) {
+		__m128 l = _mm_mul_ps(left[i], _mm_loadu_ps(scale + i * 8));
+		__m128 r = _mm_mul_ps(right[i], _mm_loadu_ps(scale + i * 8 + 4));
+		if (roundOutput) {
+			l = roundSSE41(l);
+			r = roundSSE41(r);
+		}
+		_mm_storeu_ps(coeffs + i * 8, l);
+		_mm_storeu_ps(coeffs + i * 8 + 4, r);
+	}
+}
+
+// Function to perform the 1-D integer DCT across 8 vectors of 4 lanes (same operations as performDCTInt1DScalar)
+template <bool FirstPass>
+static TARGET_SSE41 inline void performDCTInt1DSSE41(__m128i *d) {
+	const int descale = FirstPass ? INT_DESCALE_PASS1 : INT_DESCALE_PASS2;
+	const __m128i round = _mm_set1_epi32(1 << (descale - 1));
+
+	__m128i tmp0 = _mm_add_epi32(d[0], d[7]);
+	__m128i tmp7 = _mm_sub_epi32(d[0], d[7]);
+	__m128i tmp1 = _mm_add_epi32(d[1], d[6]);
+	__m128i tmp6 = _mm_sub_epi32(d[1], d[6]);
+	__m128i tmp2 = _mm_add_epi32(d[2], d[5]);
+	__m128i tmp5 = _mm_sub_epi32(d[2], d[5]);
+	__m128i tmp3 = _mm_add_epi32(d[3], d[4]);
+	__m128i tmp4 = _mm_sub_epi32(d[3], d[4]);
+
+	// even part
+	__m128i tmp10 = _mm_add_epi32(tmp0, tmp3);
+	__m128i tmp13 = _mm_sub_epi32(tmp0, tmp3);
+	__m128i tmp11 = _mm_add_epi32(tmp1, tmp2);
+	__m128i tmp12 = _mm_sub_epi32(tmp1, tmp2);
+
+	if (FirstPass) {
+		d[0] = _mm_slli_epi32(_mm_add_epi32(tmp10, tmp11), INT_PASS1_BITS);
+		d[4] = _mm_slli_epi32(_mm_sub_epi32(tmp10, tmp11), INT_PASS1_BITS);
+	} else {
+		const __m128i roundDC = _mm_set1_epi32(1 << (INT_PASS1_BITS - 1));
+		d[0] = _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(tmp10, tmp11), roundDC), INT_PASS1_BITS);
+		d[4] = _mm_srai_epi32(_mm_add_epi32(_mm_sub_epi32(tmp10, tmp11), roundDC), INT_PASS1_BITS);
+	}
+
+	__m128i z1 = _mm_mullo_epi32(_mm_add_epi32(tmp12, tmp13), _mm_set1_epi32(FIX_0_541196100));
+	d[2] = _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(z1, _mm_mullo_epi32(tmp13, _mm_set1_epi32(FIX_0_765366865))), round), descale);
+	d[6] = _mm_srai_epi32(_mm_add_epi32(_mm_sub_epi32(z1, _mm_mullo_epi32(tmp12, _mm_set1_epi32(FIX_1_847759065))), round), descale);
+
+	// odd part
+	z1 = _mm_add_epi32(tmp4, tmp7);
+	__m128i z2 = _mm_add_epi32(tmp5, tmp6);
+	__m128i z3 = _mm_add_epi32(tmp4, tmp6);
+	__m128i z4 = _mm_add_epi32(tmp5, tmp7);
+	__m128i z5 = _mm_mullo_epi32(_mm_add_epi32(z3, z4), _mm_set1_epi32(FIX_1_175875602));
+
+	tmp4 = _mm_mullo_epi32(tmp4, _mm_set1_epi32(FIX_0_298631336));
+	tmp5 = _mm_mullo_epi32(tmp5, _mm_set1_epi32(FIX_2_053119869));
+	tmp6 = _mm_mullo_epi32(tmp6, _mm_set1_epi32(FIX_3_072711026));
+	tmp7 = _mm_mullo_epi32(tmp7, _mm_set1_epi32(FIX_1_501321110));
+	z1 = _mm_mullo_epi32(z1, _mm_set1_epi32(-FIX_0_899976223));
+	z2 = _mm_mullo_epi32(z2, _mm_set1_epi32(-FIX_2_562915447));
+	z3 = _mm_add_epi32(_mm_mullo_epi32(z3, _mm_set1_epi32(-FIX_1_961570560)), z5);
+	z4 = _mm_add_epi32(_mm_mullo_epi32(z4, _mm_set1_epi32(-FIX_0_390180644)), z5);
+
+	d[7] = _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(_mm_add_epi32(tmp4, z1), z3), round), descale);
+	d[5] = _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(_mm_add_epi32(tmp5, z2), z4), round), descale);
+	d[3] = _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(_mm_add_epi32(tmp6, z2), z3), round), descale);
+	d[1] = _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(_mm_add_epi32(tmp7, z1), z4), round), descale);
+}
+
+// Function to transpose an 8x8 integer block held as left (columns 0-3) and right (columns 4-7) halves of the rows
+static TARGET_SSE41 inline void transpose8x8IntSSE41(__m128i *left, __m128i *right) {
+	__m128 l[8], r[8];
+	for (size_t i = 0; i < 8; ++i) {
+		l[i] = _mm_castsi128_ps(left[i]);
+		r[i] = _mm_castsi128_ps(right[i]);
+	}
+	transpose8x8SSE41(l, r);
+	for (size_t i = 0; i < 8; ++i) {
+		left[i] = _mm_castps_si128(l[i]);
+		right[i] = _mm_castps_si128(r[i]);
+	}
+}
+
+static TARGET_SSE41 void performDCTIntBlockSSE41(const int *block, int *coeffs) {
+	__m128i left[8], right[8];
+	for (size_t i = 0; i < 8; ++i) {
+		left[i] = _mm_loadu_si128((const __m128i *)(block + i * 8));
+		right[i] = _mm_loadu_si128((const __m128i *)(block + i * 8 + 4));
+	}
+
+	// rows first like the scalar version: transpose, rows (held as columns), transpose back, columns
+	transpose8x8IntSSE41(left, right);
+	performDCTInt1DSSE41<true>(left);
+	performDCTInt1DSSE41<true>(right);
+	transpose8x8IntSSE41(left, right);
+	performDCTInt1DSSE41<false>(left);
+	performDCTInt1DSSE41<false>(right);
+
+	for (size_t i = 0; i < 8; ++i) {
+		_mm_storeu_si128((__m128i *)(coeffs + i * 8), left[i]);
+		_mm_storeu_si128((__m128i *)(coeffs + i * 8 + 4), right[i]);
+	}
+}
+
+///////////////////////////////////////// AVX2 ///////////////////////////////////////////////////
+
+// Function to perform the 1-D AAN DCT across 8 vectors, i.e. on all 8 columns at once
+static TARGET_AVX2 inline void performAAN1DAVX2(__m256 *d) {
+	__m256 tmp0 = _mm256_add_ps(d[0], d[7]);
+	__m256 tmp7 = _mm256_sub_ps(d[0], d[7]);
+	__m256 tmp1 = _mm256_add_ps(d[1], d[6]);
+	__m256 tmp6 = _mm256_sub_ps(d[1], d[6]);
+	__m256 tmp2 = _mm256_add_ps(d[2], d[5]);
+	__m256 tmp5 = _mm256_sub_ps(d[2], d[5]);
+	__m256 tmp3 = _mm256_add_ps(d[3], d[4]);
+	__m256 tmp4 = _mm256_sub_ps(d[3], d[4]);
+
+	// even part
+	__m256 tmp10 = _mm256_add_ps(tmp0, tmp3);
+	__m256 tmp13 = _mm256_sub_ps(tmp0, tmp3);
+	__m256 tmp11 = _mm256_add_ps(tmp1, tmp2);
+	__m256 tmp12 = _mm256_sub_ps(tmp1, tmp2);
+
+	d[0] = _mm256_add_ps(tmp10, tmp11);
+	d[4] = _mm256_sub_ps(tmp10, tmp11);
+
+	__m256 z1 = _mm256_mul_ps(_mm256_add_ps(tmp12, tmp13), _mm256_set1_ps(AAN_C4));
+	d[2] = _mm256_add_ps(tmp13, z1);
+	d[6] = _mm256_sub_ps(tmp13, z1);
+
+	// odd part
+	tmp10 = _mm256_add_ps(tmp4, tmp5);
+	tmp11 = _mm256_add_ps(tmp5, tmp6);
+	tmp12 = _mm256_add_ps(tmp6, tmp7);
+
+	__m256 z5 = _mm256_mul_ps(_mm256_sub_ps(tmp10, tmp12), _mm256_set1_ps(AAN_C6));
+	__m256 z2 = _mm256_add_ps(_mm256_mul_ps(tmp10, _mm256_set1_ps(AAN_C2M6)), z5);
+	__m256 z4 = _mm256_add_ps(_mm256_mul_ps(tmp12, _mm256_set1_ps(AAN_C2P6)), z5);
+	__m256 z3 = _mm256_mul_ps(tmp11, _mm256_set1_ps(AAN_C4));
+
+	__m256 z11 = _mm256_add_ps(tmp7, z3);
+	__m256 z13 = _mm256_sub_ps(tmp7, z3);
+
+	d[5] = _mm256_add_ps(z13, z2);
+	d[3] = _mm256_sub_ps(z13, z2);
+	d[1] = _mm256_add_ps(z11, z4);
+	d[7] = _mm256_sub_ps(z11, z4);
+}
+
+// Function to transpose an 8x8 block held as 8 row vectors
+static TARGET_AVX2 inline void transpose8x8AVX2(__m256 *r) {
+	__m256 t0 = _mm256_unpacklo_ps(r[0], r[1]);
+	__m256 t1 = _mm256_unpackhi_ps(r[0], r[1]);
+	__m256 t2 = _mm256_unpacklo_ps(r[2], r[3]);
+	__m256 t3 = _mm256_unpackhi_ps(r[2], r[3]);
+	__m256 t4 = _mm256_unpacklo_ps(r[4], r[5]);
+	__m256 t5 = _mm256_unpackhi_ps(r[4], r[5]);
+	__m256 t6 = _mm256_unpacklo_ps(r[6], r[7]);
+	__m256 t7 = _mm256_unpackhi_ps(r[6], r[7]);
+
+	__m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+	__m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+	__m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+	__m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+	__m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+	__m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+	__m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+	__m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+	r[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+	r[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+	r[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+	r[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+	r[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+	r[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+	r[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+	r[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+}
+
+// Function to round to the nearest integer with halfway cases away from zero (exactly like std::round, see roundSSE41)
+static TARGET_AVX2 inline __m256 roundAVX2(__m256 x) {
+	__m256 sign = _mm256_and_ps(x, _mm256_set1_ps(-0.0f));
+	__m256 integer = _mm256_round_ps(x, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+	__m256 fraction = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), _mm256_sub_ps(x, integer));
+	__m256 carry = _mm256_and_ps(_mm256_cmp_ps(fraction, _mm256_set1_ps(0.5f), _CMP_GE_OQ), _mm256_or_ps(_mm256_set1_ps(1.0f), sign));
+	return _mm256_add_ps(integer, carry);
+}
+
+static TARGET_AVX2 void performDCTQuantBlockAVX2(const float *block, float *coeffs, const float *scale, bool roundOutput) {
+	__m256 rows[8];
+	for (size_t i = 0; i < 8; ++i) {
+		rows[i] = _mm256_loadu_ps(block + i * 8);
+	}
+
+	// columns, transpose, rows (now held as columns), transpose back
+	performAAN1DAVX2(rows);
+	transpose8x8AVX2(rows);
+	performAAN1DAVX2(rows);
+	transpose8x8AVX2(rows);
+
+	for (size_t i = 0; i < 8; ++i) {
+		__m256 c = _mm256_mul_ps(rows[i], _mm256_loadu_ps(scale + i * 8));
+		if (roundOutput) {
+			c = roundAVX2(c);
+		}
+		_mm256_storeu_ps(coeffs + i * 8, c);
+	}
+}
+
+// Function to perform the 1-D integer DCT across 8 vectors of 8 lanes (same operations as performDCTInt1DScalar)
+template <bool FirstPass>
+static TARGET_AVX2 inline void performDCTInt1DAVX2(__m256i *d) {
+	const int descale = FirstPass ? INT_DESCALE_PASS1 : INT_DESCALE_PASS2;
+	const __m256i round = _mm256_set1_epi32(1 << (descale - 1));
+
+	__m256i tmp0 = _mm256_add_epi32(d[0], d[7]);
+	__m256i tmp7 = _mm256_sub_epi32(d[0], d[7]);
+	__m256i tmp1 = _mm256_add_epi32(d[1], d[6]);
+	__m256i tmp6 = _mm256_sub_epi32(d[1], d[6]);
+	__m256i tmp2 = _mm256_add_epi32(d[2], d[5]);
+	__m256i tmp5 = _mm256_sub_epi32(d[2], d[5]);
+	__m256i tmp3 = _mm256_add_epi32(d[3], d[4]);
+	__m256i tmp4 = _mm256_sub_epi32(d[3], d[4]);
+
+	// even part
+	__m256i tmp10 = _mm256_add_epi32(tmp0, tmp3);
+	__m256i tmp13 = _mm256_sub_epi32(tmp0, tmp3);
+	__m256i tmp11 = _mm256_add_epi32(tmp1, tmp2);
+	__m256i tmp12 = _mm256_sub_epi32(tmp1, tmp2);
+
+	if (FirstPass) {
+		d[0] = _mm256_slli_epi32(_mm256_add_epi32(tmp10, tmp11), INT_PASS1_BITS);
+		d[4] = _mm256_slli_epi32(_mm256_sub_epi32(tmp10, tmp11), INT_PASS1_BITS);
+	} else {
+		const __m256i roundDC = _mm256_set1_epi32(1 << (INT_PASS1_BITS - 1));
+		d[0] = _mm256_srai_epi32(_mm256_add_epi32(_mm256_add_epi32(tmp10, tmp11), roundDC), INT_PASS1_BITS);
+		d[4] = _mm256_srai_epi32(_mm256_add_epi32(_mm256_sub_epi32(tmp10, tmp11), roundDC), INT_PASS1_BITS);
+	}
+
+	__m256i z1 = _mm256_mullo_epi32(_mm256_add_epi32(tmp12, tmp13), _mm256_set1_epi32(FIX_0_541196100));
+	d[2] = _mm256_srai_epi32(_mm256_add_epi32(_mm256_add_epi32(z1, _mm256_mullo_epi32(tmp13, _mm256_set1_epi32(FIX_0_765366865))), round), descale);
+	d[6] = _mm256_srai_epi32(_mm256_add_epi32(_mm256_sub_epi32(z1, _mm256_mullo_epi32(tmp12, _mm256_set1_epi32(FIX_1_847759065))), round), descale);
+
+	// odd part
+	z1 = _mm256_add_epi32(tmp4, tmp7);
+	__m256i z2 = _mm256_add_epi32(tmp5, tmp6);
+	__m256i z3 = _mm256_add_epi32(tmp4, tmp6);
+	__m256i z4 = _mm256_add_epi32(tmp5, tmp7);
+	__m256i z5 = _mm256_mullo_epi32(_mm256_add_epi32(z3, z4), _mm256_set1_epi32(FIX_1_175875602));
+
+	tmp4 = _mm256_mullo_epi32(tmp4, _mm256_set1_epi32(FIX_0_298631336));
+	tmp5 = _mm256_mullo_epi32(tmp5, _mm256_set1_epi32(FIX_2_053119869));
+	tmp6 = _mm256_mullo_epi32(tmp6, _mm256_set1_epi32(FIX_3_072711026));
+	tmp7 = _mm256_mullo_epi32(tmp7, _mm256_set1_epi32(FIX_1_501321110));
+	z1 = _mm256_mullo_epi32(z1, _mm256_set1_epi32(-FIX_0_899976223));
+	z2 = _mm256_mullo_epi32(z2, _mm256_set1_epi32(-FIX_2_562915447));
+	z3 = _mm256_add_epi32(_mm256_mullo_epi32(z3, _mm256_set1_epi32(-FIX_1_961570560)), z5);
+	z4 = _mm256_add_epi32(_mm256_mullo_epi32(z4, _mm256_set1_epi32(-FIX_0_390180644)), z5);
+
+	d[7] = _mm256_srai_epi32(_mm256_add_epi32(_mm256_add_epi32(_mm256_add_epi32(tmp4, z1), z3), round), descale);
+	d[5] = _mm256_srai_epi32(_mm256_add_epi32(_mm256_add_epi32(_mm256_add_epi32(tmp5, z2), z4), round), descale);
+	d[3] = _mm256_srai_epi32(_mm256_add_epi32(_mm256_add_epi32(_mm256_add_epi32(tmp6, z2), z3), round), descale);
+	d[1] = _mm256_srai_epi32(_mm256_add_epi32(_mm256_add_epi32(_mm256_add_epi32(tmp7, z1), z4), round), descale);
+}
+
+// Function to transpose an 8x8 integer block held as 8 row vectors
+static TARGET_AVX2 inline void transpose8x8IntAVX2(__m256i *rows) {
+	__m256 r[8];
+	for (size_t i = 0; i < 8; ++i) {
+		r[i] = _mm256_castsi256_ps(rows[i]);
+	}
+	transpose8x8AVX2(r);
+	for (size_t i = 0; i < 8; ++i) {
+		rows[i] = _mm256_castps_si256(r[i]);
+	}
+}
+
+static TARGET_AVX2 void performDCTIntBlockAVX2(const int *block, int *coeffs) {
+	__m256i rows[8];
+	for (size_t i = 0; i < 8; ++i) {
+		rows[i] = _mm256_loadu_si256((const __m256i *)(block + i * 8));
+	}
+
+	// rows first like the scalar version: transpose, rows (held as columns), transpose back, columns
+	transpose8x8IntAVX2(rows);
+	performDCTInt1DAVX2<true>(rows);
+	transpose8x8IntAVX2(rows);
+	performDCTInt1DAVX2<false>(rows);
+
+	for (size_t i = 0; i < 8; ++i) {
+		_mm256_storeu_si256((__m256i *)(coeffs + i * 8), rows[i]);
+	}
+}
+
+#endif // DCT_X86
+
+///////////////////////////////////////// Dispatch ///////////////////////////////////////////////
+
+// Function to get the best instruction set supported by the CPU (and the OS for the AVX registers)
+SimdLevel detectSimdLevel() {
+#if defined(DCT_X86) && defined(__GNUC__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		return SIMD_AVX2;
+	}
+	if (__builtin_cpu_supports("sse4.1")) {
+		return SIMD_SSE41;
+	}
+#elif defined(DCT_X86) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+	__cpuid(info, 1);
+	bool sse41 = (info[2] & (1 << 19)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	if (osxsave && avx && maxLeaf >= 7 && (_xgetbv(0) & 6) == 6) {
+		__cpuidex(info, 7, 0);
+		if (info[1] & (1 << 5)) {
+			return SIMD_AVX2;
+		}
+	}
+	if (sse41) {
+		return SIMD_SSE41;
+	}
+#endif
+	return SIMD_SCALAR;
+}
+
+const char* getSimdLevelName(SimdLevel level) {
+	switch (level) {
+	case SIMD_AVX2:
+		return "AVX2";
+	case SIMD_SSE41:
+		return "SSE4.1";
+	default:
+		return "scalar";
+	}
+}
+
+// Function to get the DCT kernel for an instruction set (the level must be supported by the CPU)
+DCTQuantBlockFunc getDCTQuantBlockFunc(SimdLevel level) {
+#ifdef DCT_X86
+	switch (level) {
+	case SIMD_AVX2:
+		return performDCTQuantBlockAVX2;
+	case SIMD_SSE41:
+		return performDCTQuantBlockSSE41;
+	default:
+		break;
+	}
+#endif
+	return performDCTQuantBlockScalar;
+}
+
+// Function to get the integer DCT kernel for an instruction set (the level must be supported by the CPU)
+DCTIntBlockFunc getDCTIntBlockFunc(SimdLevel level) {
+#ifdef DCT_X86
+	switch (level) {
+	case SIMD_AVX2:
+		return performDCTIntBlockAVX2;
+	case SIMD_SSE41:
+		return performDCTIntBlockSSE41;
+	default:
+		break;
+	}
+#endif
+	return performDCTIntBlockScalar;
+}
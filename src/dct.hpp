@@ -0,0 +1,39 @@
+#pragma once
+#include <cstddef>
+
+// Block level forward DCT kernels of the CPU path: single precision AAN with fused quantization and
+// a fixed-point integer DCT.
+// The scalar, SSE4.1 and AVX2 versions are compiled into the same binary and picked at runtime.
+
+// AAN scale factors: s[0] = 1, s[k] = sqrt(2) * cos(k * pi / 16)
+extern const double aanScaleFactor[8];
+
+// instruction sets of the SIMD DCT
+enum SimdLevel {
+    SIMD_SCALAR,
+    SIMD_SSE41,
+    SIMD_AVX2
+};
+
+// DCT of one 8x8 block of level shifted samples (row-major). Coefficient [v][u] is multiplied by
+// scale[v * 8 + u] (see getDCTQuantScale) and rounded to the nearest integer if roundOutput is set.
+typedef void (*DCTQuantBlockFunc)(const float *block, float *coeffs, const float *scale, bool roundOutput);
+
+// Integer DCT of one 8x8 block of level shifted samples (row-major) with 13-bit fixed-point constants
+// (the accurate integer DCT of the IJG libjpeg, jfdctint.c). The coefficients are scaled by 8 and identical
+// for every instruction set and the OpenCL kernel DCTIntKernel.
+typedef void (*DCTIntBlockFunc)(const int *block, int *coeffs);
+
+// Function to quantize an integer DCT coefficient (scaled by 8), rounding halfway cases away from zero
+// Gives the same result as std::round(coeff / 8.0 / quant)
+inline int quantizeIntCoefficient(int coeff, unsigned int quant) {
+	int divisor = (int)quant * 8;
+	return (coeff < 0) ? -((-coeff + divisor / 2) / divisor) : (coeff + divisor / 2) / divisor;
+}
+
+SimdLevel detectSimdLevel();
+const char* getSimdLevelName(SimdLevel);
+DCTQuantBlockFunc getDCTQuantBlockFunc(SimdLevel);
+DCTIntBlockFunc getDCTIntBlockFunc(SimdLevel);
+void getDCTQuantScale(const unsigned int [][8], float [64]);
+void getDCTMatrix(float [64]);
@@ -1,6 +1,7 @@
 #pragma once
 #include <vector>
 #include <string>
+#include <cstdint>
 
 // Standard Huffman Tables
 // See Annex-K of the JPEG standard - https://www.w3.org/Graphics/JPEG/itu-t81.pdf
@@ -89,13 +90,13 @@ const std::vector<std::vector<std::string>> AC_LUMA_HUFF_CODES =
         "111010"            , // 3/1
         "111110111"         , // 3/2
         "111111110101"      , // 3/3
-        "11111111110001111" , // 3/4
-        "11111111110010000" , // 3/5
-        "11111111110010001" , // 3/6
-        "11111111110010010" , // 3/7
-        "11111111110010011" , // 3/8
-        "11111111110010100" , // 3/9
-        "11111111110010101"   // 3/A
+        "1111111110001111"  , // 3/4
+        "1111111110010000"  , // 3/5
+        "1111111110010001"  , // 3/6
+        "1111111110010010"  , // 3/7
+        "1111111110010011"  , // 3/8
+        "1111111110010100"  , // 3/9
+        "1111111110010101"    // 3/A
     },
     
     {
@@ -425,4 +426,89 @@ const std::vector<std::vector<std::string>> AC_CHROMA_HUFF_CODES =
     "1111111111111100", // F/8
     "1111111111111101", // F/9
     "1111111111111110"} // F/A
-};
\ No newline at end of file
+};
+
+// Packed Huffman code tables
+// Generated at compile time from the BITS/HUFFVAL lists of Annex K (K.3 - K.6), the same
+// form in which the tables are stored in a DHT segment. Both arrays are indexed by the
+// symbol, i.e. the category for DC tables and (run << 4) | size for AC tables.
+struct HuffmanCodeTable {
+    uint16_t code[256];
+    uint8_t length[256];
+};
+
+// Number of codes of each length 1..16 and the symbols in order of increasing code length
+const uint8_t DC_LUMA_BITS[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+const uint8_t DC_LUMA_HUFFVAL[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+
+const uint8_t DC_CHROMA_BITS[16] = {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0};
+const uint8_t DC_CHROMA_HUFFVAL[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+
+const uint8_t AC_LUMA_BITS[16] = {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d};
+const uint8_t AC_LUMA_HUFFVAL[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+const uint8_t AC_CHROMA_BITS[16] = {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77};
+const uint8_t AC_CHROMA_HUFFVAL[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+// Assign canonical codes to the symbols (Annex C, Figures C.1 - C.3)
+constexpr HuffmanCodeTable buildHuffmanCodeTable(const uint8_t *bits, const uint8_t *huffval) {
+    HuffmanCodeTable table = {};
+    uint16_t code = 0;
+    int k = 0;
+    for (int len = 1; len <= 16; ++len) {
+        for (int i = 0; i < bits[len - 1]; ++i) {
+            table.code[huffval[k]] = code++;
+            table.length[huffval[k]] = len;
+            ++k;
+        }
+        code <<= 1;
+    }
+    return table;
+}
+
+constexpr HuffmanCodeTable DC_LUMA_HUFF_TABLE = buildHuffmanCodeTable(DC_LUMA_BITS, DC_LUMA_HUFFVAL);
+constexpr HuffmanCodeTable DC_CHROMA_HUFF_TABLE = buildHuffmanCodeTable(DC_CHROMA_BITS, DC_CHROMA_HUFFVAL);
+constexpr HuffmanCodeTable AC_LUMA_HUFF_TABLE = buildHuffmanCodeTable(AC_LUMA_BITS, AC_LUMA_HUFFVAL);
+constexpr HuffmanCodeTable AC_CHROMA_HUFF_TABLE = buildHuffmanCodeTable(AC_CHROMA_BITS, AC_CHROMA_HUFFVAL);
+
+static_assert(AC_LUMA_HUFF_TABLE.code[0x00] == 0x000A && AC_LUMA_HUFF_TABLE.length[0x00] == 4, "AC luma EOB must be 1010");
+static_assert(AC_LUMA_HUFF_TABLE.code[0xF0] == 0x07F9 && AC_LUMA_HUFF_TABLE.length[0xF0] == 11, "AC luma ZRL must be 11111111001");
+static_assert(AC_CHROMA_HUFF_TABLE.code[0xFA] == 0xFFFE && AC_CHROMA_HUFF_TABLE.length[0xFA] == 16, "AC chroma F/A must be 1111111111111110");
+
+// Huffman tables of a scan: BITS/HUFFVAL as stored in the DHT segment and the codes derived from them
+// Index 0 = DC luminance, 1 = AC luminance, 2 = DC chrominance, 3 = AC chrominance
+#define HUFF_DC_LUMA   0
+#define HUFF_AC_LUMA   1
+#define HUFF_DC_CHROMA 2
+#define HUFF_AC_CHROMA 3
+
+struct HuffmanTableSet {
+    uint8_t bits[4][16];
+    uint8_t huffval[4][256];
+    size_t numValues[4];
+    HuffmanCodeTable codes[4];
+};
@@ -0,0 +1,188 @@
+#include <cstring>
+#include <iostream>
+
+#include <OpenCL/cl-patched.hpp>
+#include "huffman.hpp"
+#include "utils.hpp"
+#include "jfif.hpp"
+
+// Sizes of the marker segments including the marker itself
+#define JFIF_APP0_SIZE (2 + 16)
+// (DQT with one table per component type, SOF0 and SOS with numComponents components)
+#define JFIF_DQT_SIZE(numTables) (2 + 2 + (numTables) * 65)
+#define JFIF_SOF0_SIZE(numComponents) (2 + 2 + 6 + (numComponents) * 3)
+#define JFIF_SOS_SIZE(numComponents) (2 + 2 + 1 + (numComponents) * 2 + 3)
+#define JFIF_DRI_SIZE (2 + 2 + 2)
+
+// Function to write a marker
+static inline uint8_t* putMarker(uint8_t *p, uint8_t marker) {
+	p[0] = 0xFF;
+	p[1] = marker;
+	return p + 2;
+}
+
+// Function to write a big endian 16 bit value
+static inline uint8_t* put16(uint8_t *p, uint16_t value) {
+	p[0] = (uint8_t)(value >> 8);
+	p[1] = (uint8_t)value;
+	return p + 2;
+}
+
+// Function to get the tables of the DHT segment
+static const HuffmanTableSet& getHuffmanTables(const JFIFHeader& header) {
+	return header.huffmanTables ? *header.huffmanTables : getStandardHuffmanTables();
+}
+
+// Function to get the number of quantization and huffman table pairs (luminance and chrominance, or luminance only)
+static size_t getNumTableIds(const JFIFHeader& header) {
+	return (header.numComponents == 1) ? 1 : 2;
+}
+
+// Function to get the size of the DHT segment holding the four tables (the two luminance tables for grayscale images)
+static size_t getDHTSize(const JFIFHeader& header) {
+	const HuffmanTableSet& tables = getHuffmanTables(header);
+	size_t size = 2 + 2 + 2 * 17 + tables.numValues[HUFF_DC_LUMA] + tables.numValues[HUFF_AC_LUMA];
+	if (getNumTableIds(header) == 2) {
+		size += 2 * 17 + tables.numValues[HUFF_DC_CHROMA] + tables.numValues[HUFF_AC_CHROMA];
+	}
+	return size;
+}
+
+// Function to write one table (class and id, BITS, HUFFVAL) of a DHT segment
+static uint8_t* putHuffmanTable(uint8_t *p, uint8_t classAndId, const uint8_t *bits, const uint8_t *huffval, size_t numValues) {
+	*p++ = classAndId;
+	memcpy(p, bits, 16);
+	p += 16;
+	memcpy(p, huffval, numValues);
+	return p + numValues;
+}
+
+// Function to get the number of bytes in front of the entropy-coded data
+size_t getJFIFHeaderSize(const JFIFHeader& header) {
+	size_t driSize = (header.restartInterval > 0) ? JFIF_DRI_SIZE : 0;
+	return 2 + JFIF_APP0_SIZE + JFIF_DQT_SIZE(getNumTableIds(header)) + JFIF_SOF0_SIZE(header.numComponents) + getDHTSize(header) + driSize + JFIF_SOS_SIZE(header.numComponents);
+}
+
+// Function to get the size of the complete file for a given amount of entropy-coded data
+size_t getJFIFFileSize(const JFIFHeader& header, size_t scanSize) {
+	return getJFIFHeaderSize(header) + scanSize + 2;
+}
+
+// Function to write SOI, APP0, DQT, SOF0, DHT, DRI (if enabled) and SOS into the output buffer
+// Returns the number of bytes written or 0 if the buffer is too small or the image does not fit into the SOF segment
+size_t writeJFIFHeader(uint8_t *out, size_t capacity, const JFIFHeader& header) {
+	if (capacity < getJFIFHeaderSize(header)) {
+		return 0;
+	}
+	if (header.width > JPEG_MAX_DIMENSION || header.height > JPEG_MAX_DIMENSION) {
+		return 0;
+	}
+	uint8_t *p = out;
+
+	// start of image
+	p = putMarker(p, JPEG_MARKER_SOI);
+
+	// JFIF application segment: version 1.01, no units, 1:1 aspect ratio, no thumbnail
+	p = putMarker(p, JPEG_MARKER_APP0);
+	p = put16(p, JFIF_APP0_SIZE - 2);
+	memcpy(p, "JFIF", 5);
+	p += 5;
+	*p++ = 1;
+	*p++ = 1;
+	*p++ = 0;
+	p = put16(p, 1);
+	p = put16(p, 1);
+	*p++ = 0;
+	*p++ = 0;
+
+	// quantization tables (8 bit precision) in zigzag order: 0 = luminance, 1 = chrominance
+	p = putMarker(p, JPEG_MARKER_DQT);
+	p = put16(p, JFIF_DQT_SIZE(getNumTableIds(header)) - 2);
+	*p++ = 0x00;
+	for (size_t i = 0; i < 64; ++i) {
+		*p++ = (uint8_t)header.quantLum[zigzag_order[i] / 8][zigzag_order[i] % 8];
+	}
+	if (getNumTableIds(header) == 2) {
+		*p++ = 0x01;
+		for (size_t i = 0; i < 64; ++i) {
+			*p++ = (uint8_t)header.quantChrom[zigzag_order[i] / 8][zigzag_order[i] % 8];
+		}
+	}
+
+	// baseline frame header: Y with the sampling factors of the header, Cb and Cr with 1x1 sampling
+	// (the sampling factors of a single component do not matter, they are written as 1x1)
+	p = putMarker(p, JPEG_MARKER_SOF0);
+	p = put16(p, JFIF_SOF0_SIZE(header.numComponents) - 2);
+	*p++ = 8;
+	p = put16(p, (uint16_t)header.height);
+	p = put16(p, (uint16_t)header.width);
+	*p++ = (uint8_t)header.numComponents;
+	for (uint8_t comp = 1; comp <= header.numComponents; ++comp) {
+		*p++ = comp;
+		*p++ = (comp == 1 && header.numComponents == 3) ? (uint8_t)((header.samplingX << 4) | header.samplingY) : 0x11;
+		*p++ = (comp == 1) ? 0 : 1;
+	}
+
+	// huffman tables (Annex K or optimized): class 0 = DC, class 1 = AC, id 0 = luminance, id 1 = chrominance
+	const HuffmanTableSet& tables = getHuffmanTables(header);
+	p = putMarker(p, JPEG_MARKER_DHT);
+	p = put16(p, getDHTSize(header) - 2);
+	p = putHuffmanTable(p, 0x00, tables.bits[HUFF_DC_LUMA], tables.huffval[HUFF_DC_LUMA], tables.numValues[HUFF_DC_LUMA]);
+	p = putHuffmanTable(p, 0x10, tables.bits[HUFF_AC_LUMA], tables.huffval[HUFF_AC_LUMA], tables.numValues[HUFF_AC_LUMA]);
+	if (getNumTableIds(header) == 2) {
+		p = putHuffmanTable(p, 0x01, tables.bits[HUFF_DC_CHROMA], tables.huffval[HUFF_DC_CHROMA], tables.numValues[HUFF_DC_CHROMA]);
+		p = putHuffmanTable(p, 0x11, tables.bits[HUFF_AC_CHROMA], tables.huffval[HUFF_AC_CHROMA], tables.numValues[HUFF_AC_CHROMA]);
+	}
+
+	// restart interval definition
+	if (header.restartInterval > 0) {
+		p = putMarker(p, JPEG_MARKER_DRI);
+		p = put16(p, JFIF_DRI_SIZE - 2);
+		p = put16(p, (uint16_t)header.restartInterval);
+	}
+
+	// scan header: all components (interleaved if more than one), full spectral range
+	p = putMarker(p, JPEG_MARKER_SOS);
+	p = put16(p, JFIF_SOS_SIZE(header.numComponents) - 2);
+	*p++ = (uint8_t)header.numComponents;
+	for (uint8_t comp = 1; comp <= header.numComponents; ++comp) {
+		*p++ = comp;
+		*p++ = (comp == 1) ? 0x00 : 0x11;
+	}
+	*p++ = 0;
+	*p++ = 63;
+	*p++ = 0;
+
+	return p - out;
+}
+
+// Function to write the complete JFIF file (headers, entropy-coded data, EOI) into the output buffer
+// Returns the number of bytes written or 0 if the buffer is too small
+size_t writeJFIF(uint8_t *out, size_t capacity, const JFIFHeader& header, const uint8_t *scanData, size_t scanSize) {
+	if (capacity < getJFIFFileSize(header, scanSize)) {
+		return 0;
+	}
+	size_t headerSize = writeJFIFHeader(out, capacity, header);
+	if (headerSize == 0) {
+		return 0;
+	}
+	uint8_t *p = out + headerSize;
+	memcpy(p, scanData, scanSize);
+	p += scanSize;
+	p = putMarker(p, JPEG_MARKER_EOI);
+	return p - out;
+}
+
+// Write the JPEG image to file
+int writeJPEGImage(const char * file_path, const uint8_t *data, size_t size) {
+	FILE *fp = fopen(file_path, "wb");
+
+	if (fp) {
+		fwrite(data, 1, size, fp);
+		fclose(fp);
+	} else {
+		std::cout << "Error opening the file" << std::endl;
+		return -1;
+	}
+	return 0;
+}
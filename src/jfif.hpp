@@ -0,0 +1,40 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+// JPEG markers (Table B.1 of the JPEG standard)
+#define JPEG_MARKER_SOI  0xD8
+#define JPEG_MARKER_EOI  0xD9
+#define JPEG_MARKER_APP0 0xE0
+#define JPEG_MARKER_DQT  0xDB
+#define JPEG_MARKER_SOF0 0xC0
+#define JPEG_MARKER_DHT  0xC4
+#define JPEG_MARKER_SOS  0xDA
+#define JPEG_MARKER_DRI  0xDD
+#define JPEG_MARKER_RST0 0xD0 // RST0..RST7 = 0xD0..0xD7
+
+// largest image width and height of the SOF segment (16 bit fields)
+#define JPEG_MAX_DIMENSION 65535
+
+struct HuffmanTableSet;
+
+// parameters of the baseline JFIF file written around the entropy-coded data
+struct JFIFHeader {
+	size_t width;                        // original (unpadded) image width
+	size_t height;                       // original (unpadded) image height
+	const unsigned int (*quantLum)[8];   // luminance quantization matrix (row major)
+	const unsigned int (*quantChrom)[8]; // chrominance quantization matrix (row major), not written for grayscale images
+	unsigned int numComponents;          // 3 = Y, Cb, Cr; 1 = Y (grayscale, single component scan)
+	unsigned int samplingX;              // horizontal sampling factor of Y (Cb and Cr are sampled 1x1), 2 for 4:2:0
+	unsigned int samplingY;              // vertical sampling factor of Y, 2 for 4:2:0
+	unsigned int restartInterval;        // MCUs per restart interval, 0 = no DRI segment / RST markers
+	const HuffmanTableSet *huffmanTables; // tables of the DHT segment, NULL = standard tables of Annex K
+};
+
+size_t getJFIFHeaderSize(const JFIFHeader&);
+size_t getJFIFFileSize(const JFIFHeader&, size_t);
+
+size_t writeJFIFHeader(uint8_t *, size_t, const JFIFHeader&);
+size_t writeJFIF(uint8_t *, size_t, const JFIFHeader&, const uint8_t *, size_t);
+
+int writeJPEGImage(const char *, const uint8_t *, size_t);
@@ -0,0 +1,111 @@
+#pragma once
+#include <cstddef>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size pool of worker threads for data parallel loops on the CPU.
+// The threads are created once and sleep between calls to parallelFor().
+class ThreadPool {
+public:
+	// numThreads = 0 uses one thread per hardware thread
+	explicit ThreadPool(unsigned int numThreads = 0) : m_count(0), m_next(0), m_active(0), m_generation(0), m_stop(false) {
+		if (numThreads == 0) {
+			numThreads = std::thread::hardware_concurrency();
+		}
+		if (numThreads == 0) {
+			numThreads = 1;
+		}
+		// the calling thread takes part in every loop, so one thread less is started
+		for (unsigned int i = 1; i < numThreads; ++i) {
+			m_workers.emplace_back(&ThreadPool::workerLoop, this);
+		}
+	}
+
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_wake.notify_all();
+		for (size_t i = 0; i < m_workers.size(); ++i) {
+			m_workers[i].join();
+		}
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// Number of threads working on a loop (including the calling thread)
+	unsigned int size() const { return m_workers.size() + 1; }
+
+	// Call body(i) for every i in [0, count) and return when all calls have finished
+	// The indices are handed out one at a time, so uneven work per index is balanced
+	void parallelFor(size_t count, const std::function<void(size_t)>& body) {
+		if (m_workers.empty() || count < 2) {
+			for (size_t i = 0; i < count; ++i) {
+				body(i);
+			}
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_body = &body;
+			m_count = count;
+			m_next = 0;
+			m_active = m_workers.size();
+			++m_generation;
+		}
+		m_wake.notify_all();
+
+		runItems(body);
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_done.wait(lock, [this] { return m_active == 0; });
+		m_body = NULL;
+	}
+
+private:
+	std::vector<std::thread> m_workers;
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_done;
+	const std::function<void(size_t)> *m_body = NULL;
+	size_t m_count;
+	std::atomic<size_t> m_next;
+	size_t m_active;
+	unsigned long m_generation;
+	bool m_stop;
+
+	void runItems(const std::function<void(size_t)>& body) {
+		for (size_t i = m_next++; i < m_count; i = m_next++) {
+			body(i);
+		}
+	}
+
+	void workerLoop() {
+		unsigned long seenGeneration = 0;
+		for (;;) {
+			const std::function<void(size_t)> *body;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_wake.wait(lock, [&] { return m_stop || m_generation != seenGeneration; });
+				if (m_stop) {
+					return;
+				}
+				seenGeneration = m_generation;
+				body = m_body;
+			}
+
+			runItems(*body);
+
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (--m_active == 0) {
+				m_done.notify_one();
+			}
+		}
+	}
+};
@@ -1,14 +1,129 @@
 #include <iomanip>
 #include <cmath>
 #include <vector>
+#include <algorithm>
+#include <random>
 
 #include <OpenCL/cl-patched.hpp>
 #include "huffman.hpp"
 #include "utils.hpp"
+#include "jfif.hpp"
+
+
+// Function to parse the encoder options from the command line
+// Supported: -r <restart interval in MCUs (0..65535)> -t <number of threads> -o (optimized huffman tables) -m <DCT method: ref|aan|simd|int> -k <GPU DCT kernel: naive|tiled> -s <chroma subsampling: 444|422|420|440> -d <gpu|cpu> -i <input PPM/PGM file>
+int parseEncoderOptions(int argc, char **argv, EncoderOptions *options) {
+	options->restartInterval = 0;
+	options->numThreads = 0;
+	options->optimizeHuffman = false;
+	options->checkGPU = false;
+	options->dctMethod = DCT_REFERENCE;
+	options->gpuDCTKernel = GPU_DCT_NAIVE;
+	options->gpuPipeline = GPU_PIPELINE_STAGES;
+	options->chromaSubsampling = CHROMA_420;
+	options->deviceType = CL_DEVICE_TYPE_GPU;
+	options->inputFile = "../data/fruit.ppm";
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "-o") {
+			options->optimizeHuffman = true;
+		} else if (arg == "-c") {
+			options->checkGPU = true;
+		} else if (arg == "-m" && i + 1 < argc) {
+			std::string method = argv[++i];
+			if (method == getDCTMethodName(DCT_REFERENCE)) {
+				options->dctMethod = DCT_REFERENCE;
+			} else if (method == getDCTMethodName(DCT_AAN)) {
+				options->dctMethod = DCT_AAN;
+			} else if (method == getDCTMethodName(DCT_SIMD)) {
+				options->dctMethod = DCT_SIMD;
+			} else if (method == getDCTMethodName(DCT_INT)) {
+				options->dctMethod = DCT_INT;
+			} else {
+				std::cout << "Invalid value for -m: " << method << std::endl;
+				return -1;
+			}
+		} else if (arg == "-k" && i + 1 < argc) {
+			std::string kernel = argv[++i];
+			if (kernel == getGPUDCTKernelName(GPU_DCT_NAIVE)) {
+				options->gpuDCTKernel = GPU_DCT_NAIVE;
+			} else if (kernel == getGPUDCTKernelName(GPU_DCT_TILED)) {
+				options->gpuDCTKernel = GPU_DCT_TILED;
+			} else {
+				std::cout << "Invalid value for -k: " << kernel << std::endl;
+				return -1;
+			}
+		} else if (arg == "-p" && i + 1 < argc) {
+			std::string pipeline = argv[++i];
+			if (pipeline == getGPUPipelineName(GPU_PIPELINE_STAGES)) {
+				options->gpuPipeline = GPU_PIPELINE_STAGES;
+			} else if (pipeline == getGPUPipelineName(GPU_PIPELINE_FUSED)) {
+				options->gpuPipeline = GPU_PIPELINE_FUSED;
+			} else {
+				std::cout << "Invalid value for -p: " << pipeline << std::endl;
+				return -1;
+			}
+		} else if (arg == "-s" && i + 1 < argc) {
+			std::string mode = argv[++i];
+			if (mode == getChromaSubsamplingName(CHROMA_444)) {
+				options->chromaSubsampling = CHROMA_444;
+			} else if (mode == getChromaSubsamplingName(CHROMA_422)) {
+				options->chromaSubsampling = CHROMA_422;
+			} else if (mode == getChromaSubsamplingName(CHROMA_420)) {
+				options->chromaSubsampling = CHROMA_420;
+			} else if (mode == getChromaSubsamplingName(CHROMA_440)) {
+				options->chromaSubsampling = CHROMA_440;
+			} else {
+				std::cout << "Invalid value for -s: " << mode << std::endl;
+				return -1;
+			}
+		} else if (arg == "-i" && i + 1 < argc) {
+			options->inputFile = argv[++i];
+		} else if (arg == "-d" && i + 1 < argc) {
+			std::string device = argv[++i];
+			if (device == "gpu") {
+				options->deviceType = CL_DEVICE_TYPE_GPU;
+			} else if (device == "cpu") {
+				options->deviceType = CL_DEVICE_TYPE_CPU;
+			} else {
+				std::cout << "Invalid value for -d: " << device << std::endl;
+				return -1;
+			}
+		} else if ((arg == "-r" || arg == "-t") && i + 1 < argc) {
+			char *end;
+			unsigned long value = strtoul(argv[++i], &end, 10);
+			if (*end != '\0' || (arg == "-r" && value > 65535)) {
+				std::cout << "Invalid value for " << arg << ": " << argv[i] << std::endl;
+				return -1;
+			}
+			if (arg == "-r") {
+				options->restartInterval = (unsigned int)value;
+			} else {
+				options->numThreads = (unsigned int)value;
+			}
+		} else {
+			std::cout << "Usage: " << argv[0] << " [-r restart_interval] [-t num_threads] [-o] [-c] [-m ref|aan|simd|int] [-k naive|tiled] [-p stages|fused] [-s 444|422|420|440] [-d gpu|cpu] [-i input.ppm|input.pgm]" << std::endl;
+			return -1;
+		}
+	}
+	return 0;
+}
 
+// Function to allocate the pixels of an image with malloc (the allocator of readPPMImage)
+rgb_pixel_t *allocatePixels(size_t width, size_t height, unsigned int channels, void *) {
+	return (rgb_pixel_t *)malloc(width * height * channels);
+}
 
 // Read the PPM image from file
-int readPPMImage(const char * file_path, size_t *width, size_t *height, rgb_pixel_t **imgptr) {
+// PGM images (P5) keep one gray value per pixel, channels receives the bytes per pixel (3 or 1, see ppm_t)
+int readPPMImage(const char * file_path, size_t *width, size_t *height, rgb_pixel_t **imgptr, unsigned int *channels) {
+	return readPPMImageInto(file_path, width, height, imgptr, channels, allocatePixels, NULL);
+}
+
+// Read a PPM (P6) or PGM (P5) image into pixels from the given allocator, which gets the image size and the bytes per pixel
+// (e.g. pinned host memory of a device buffer, so the file is read straight into the memory used by the device)
+int readPPMImageInto(const char * file_path, size_t *width, size_t *height, rgb_pixel_t **imgptr, unsigned int *channels, PixelAllocator allocator, void *allocatorContext) {
 	char line[128];
 	FILE *fp = fopen(file_path, "rb");
 
@@ -19,7 +134,8 @@ int readPPMImage(const char * file_path, size_t *width, size_t *height, rgb_pixe
 			return -1;
 		}
 
-		if (strcmp(line, "P6\n")) {
+		bool gray = !strcmp(line, "P5\n");
+		if (strcmp(line, "P6\n") && !gray) {
 			std::cout << "Invalid file format" << std::endl;
 			fclose(fp);
 			return -1;
@@ -45,9 +161,10 @@ int readPPMImage(const char * file_path, size_t *width, size_t *height, rgb_pixe
 		}
 
 		unsigned int img_dims = *width * *height;
+		*channels = gray ? 1 : 3;
 
 		// assign memory to the image
-		*imgptr = (rgb_pixel_t *)malloc(img_dims * sizeof(rgb_pixel_t));
+		*imgptr = allocator(*width, *height, *channels, allocatorContext);
 
 		if (*imgptr == NULL) {
 			std::cout << "Error allocating memory" << std::endl;
@@ -55,7 +172,7 @@ int readPPMImage(const char * file_path, size_t *width, size_t *height, rgb_pixe
 			return -1;
 		}
 
-		fread(*imgptr, sizeof(rgb_pixel_t), img_dims, fp);
+		fread(*imgptr, *channels, img_dims, fp);
 		fclose(fp);
 	} else {
 		std::cout << "Error opening the file" << std::endl;
@@ -64,15 +181,15 @@ int readPPMImage(const char * file_path, size_t *width, size_t *height, rgb_pixe
 	return 0;
 }
 
-// Write the PPM image to file
-int writePPMImage(const char * file_path, size_t width, size_t height, rgb_pixel_t *imgptr) {
+// Write the PPM image to file (a PGM image for one gray value per pixel, channels = 1)
+int writePPMImage(const char * file_path, size_t width, size_t height, rgb_pixel_t *imgptr, unsigned int channels) {
     FILE *fp = fopen(file_path, "wb");
 
     if (fp) {
-        fprintf(fp, "P6\n");
+        fprintf(fp, (channels == 1) ? "P5\n" : "P6\n");
         fprintf(fp, "%d %d\n", width, height);
         fprintf(fp, "255\n");
-        fwrite(imgptr, sizeof(rgb_pixel_t), width * height, fp);
+        fwrite(imgptr, channels, width * height, fp);
         fclose(fp);
     } else {
         std::cout << "Error opening the file" << std::endl;
@@ -81,8 +198,35 @@ int writePPMImage(const char * file_path, size_t width, size_t height, rgb_pixel
     return 0;
 }
 
+// Function to check whether all pixels of the image are gray: read from a PGM file or R == G == B in every pixel
+// Such images are encoded with the Y component only
+bool isGrayscaleImage(const ppm_t *img) {
+	if (img->channels == 1) {
+		return true;
+	}
+	for (size_t i = 0; i < img->width * img->height; ++i) {
+		if (img->data[i].r != img->data[i].g || img->data[i].r != img->data[i].b) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Function to pack the pixels of a gray RGB image (see isGrayscaleImage) in place into one gray value per pixel,
+// the layout of PGM images
+void packGrayscaleImage(ppm_t *img) {
+	uint8_t *grayValues = (uint8_t *)img->data;
+	for (size_t i = 0; i < img->width * img->height; ++i) {
+		grayValues[i] = img->data[i].r;
+	}
+	img->channels = 1;
+}
+
 // Function to remove the red channel from the image - TEST FUNCTION
 void removeRedChannel(ppm_t *img) {
+	if (img->channels != 3) {
+		return;
+	}
 	for (size_t i = 0; i < img->width * img->height; ++i) {
 		img->data[i].r = 0;
 	}
@@ -109,6 +253,77 @@ void performCSC(ppm_t *img) {
 	}
 }
 
+// Function to perform the Color Space Conversion and the Level Shifting in one pass
+// Same conversion as performCSC, but in 14-bit fixed point (rounded instead of truncated) and with
+// the -128 of the level shift folded into the constants. The interleaved RGB pixels are split
+// into the Y, Cb and Cr planes of 'out' (same size as img), 16 or 32 pixels at a time with SIMD.
+void performCSCFixed(const ppm_t *img, sample_image_t *out, SimdLevel level) {
+	CSCFunc csc = getCSCFunc(level);
+	csc((const uint8_t *)img->data, getSamplePlane(out, 0), getSamplePlane(out, 1), getSamplePlane(out, 2), img->width * img->height);
+}
+
+// Function to level shift the gray values of a grayscale image into the Y plane of 'out' (same size as img)
+// Y = R = G = B for gray pixels, so the color space conversion reduces to the level shift
+void performGrayscaleConversion(const ppm_t *img, sample_image_t *out) {
+	const uint8_t *grayValues = (const uint8_t *)img->data;
+	int8_t *planeY = getSamplePlane(out, 0);
+	for (size_t i = 0; i < img->width * img->height; ++i) {
+		planeY[i] = (int8_t)(grayValues[i * img->channels] - 128);
+	}
+}
+
+// Function to check the fixed-point color space conversion of every instruction set
+// against the exact conversion (tolerance: rounding plus the error of the 14-bit constants),
+// the SIMD versions also have to give the same samples as the scalar version
+bool checkCSCAccuracy() {
+	// a grid over the RGB cube, the odd number of pixels also runs the scalar tail of the SIMD versions
+	std::vector<rgb_pixel_t> pixels;
+	for (int r = 0; r <= 255; r += 5) {
+		for (int g = 0; g <= 255; g += 5) {
+			for (int b = 0; b <= 255; b += 5) {
+				pixels.push_back({(uint8_t)r, (uint8_t)g, (uint8_t)b});
+			}
+		}
+	}
+	pixels.push_back({255, 0, 255});
+	ppm_t img = {pixels.size(), 1, pixels.data(), 3};
+
+	sample_image_t scalar = {pixels.size(), 1, 1, 1, 3, NULL};
+	std::vector<int8_t> scalarData(3 * pixels.size());
+	scalar.data = scalarData.data();
+	performCSCFixed(&img, &scalar, SIMD_SCALAR);
+
+	bool passed = true;
+	SimdLevel maxLevel = detectSimdLevel();
+	for (int level = SIMD_SCALAR; level <= maxLevel; ++level) {
+		sample_image_t samples = {pixels.size(), 1, 1, 1, 3, NULL};
+		std::vector<int8_t> data(3 * pixels.size());
+		samples.data = data.data();
+		performCSCFixed(&img, &samples, (SimdLevel)level);
+
+		double maxError = 0.0;
+		size_t mismatches = 0;
+		for (size_t i = 0; i < pixels.size(); ++i) {
+			double r = pixels[i].r, g = pixels[i].g, b = pixels[i].b;
+			double exact[3] = {
+				0.299 * r + 0.587 * g + 0.114 * b - 128,
+				-0.168736 * r - 0.331264 * g + 0.5 * b,
+				0.5 * r - 0.418688 * g - 0.081312 * b
+			};
+			for (size_t c = 0; c < 3; ++c) {
+				int8_t sample = getSamplePlane(&samples, c)[i];
+				maxError = std::max(maxError, std::abs(sample - exact[c]));
+				if (sample != getSamplePlane(&scalar, c)[i]) {
+					++mismatches;
+				}
+			}
+		}
+		std::cout << "CSC accuracy check (" << getSimdLevelName((SimdLevel)level) << "): max. sample error " << maxError << ", samples different from scalar " << mismatches << std::endl;
+		passed = passed && maxError < 0.6 && mismatches == 0;
+	}
+	return passed;
+}
+
 // Function to perform Color Downsampling
 void performCDS(ppm_t *img) {
 	/* CDS = Color Downsampling
@@ -140,6 +355,86 @@ void performCDS(ppm_t *img) {
 	}
 }
 
+// Function to average SX x SY blocks of two rows of level shifted chroma samples (SX, SY = 1 or 2)
+// into one row of a subsampled plane. row2 is the second row of the blocks (ignored for SY = 1),
+// the last column of odd widths is averaged with itself.
+// Same average as performCDS: the sum is shifted instead of divided, which rounds down
+// like the truncation of the unshifted samples in performCDS
+template<unsigned int SX, unsigned int SY>
+static inline void downsampleChromaRow(const int8_t *row1, const int8_t *row2, size_t width, int8_t *out, size_t chromaWidth) {
+	const int shift = (SX - 1) + (SY - 1);
+	for (size_t x = 0; x < chromaWidth; ++x) {
+		size_t x1 = SX * x;
+		size_t x2 = (SX == 2 && x1 + 1 < width) ? x1 + 1 : x1;
+		int sum = row1[x1];
+		if (SX == 2) {
+			sum += row1[x2];
+		}
+		if (SY == 2) {
+			sum += row2[x1];
+			if (SX == 2) {
+				sum += row2[x2];
+			}
+		}
+		out[x] = (int8_t)(sum >> shift);
+	}
+}
+
+// Function to convert the image into the Y plane and the SX x SY subsampled Cb and Cr planes of 'out'
+// in one pass: SY rows at a time are converted (performCSCFixed), Y straight into its plane, Cb and Cr
+// into rows that stay in the cache until they are averaged into the subsampled planes.
+// The last row of odd heights is averaged with itself.
+template<unsigned int SX, unsigned int SY>
+static void convertAndDownsample(const ppm_t *img, sample_image_t *out, CSCFunc csc) {
+	out->subsamplingX = SX;
+	out->subsamplingY = SY;
+	size_t chromaWidth = getPlaneSize(img->width, SX, 1);
+	size_t chromaHeight = getPlaneSize(img->height, SY, 1);
+	int8_t *planeY = getSamplePlane(out, 0);
+	int8_t *planeCb = getSamplePlane(out, 1);
+	int8_t *planeCr = getSamplePlane(out, 2);
+
+	// SY rows of full resolution Cb and Cr samples
+	std::vector<int8_t> rowsCb(SY * img->width);
+	std::vector<int8_t> rowsCr(SY * img->width);
+	for (size_t y = 0; y < chromaHeight; ++y) {
+		size_t numRows = (SY == 2 && SY * y + 1 < img->height) ? 2 : 1;
+		for (size_t r = 0; r < numRows; ++r) {
+			size_t row = SY * y + r;
+			csc((const uint8_t *)(img->data + row * img->width), planeY + row * img->width, &rowsCb[r * img->width], &rowsCr[r * img->width], img->width);
+		}
+		size_t row2 = (numRows == 2) ? img->width : 0;
+		downsampleChromaRow<SX, SY>(&rowsCb[0], &rowsCb[row2], img->width, planeCb + y * chromaWidth, chromaWidth);
+		downsampleChromaRow<SX, SY>(&rowsCr[0], &rowsCr[row2], img->width, planeCr + y * chromaWidth, chromaWidth);
+	}
+}
+
+// Function to perform the Color Space Conversion, the Color Downsampling and the Level Shifting in one pass
+// 'out' (same size as img) receives the level shifted Y plane and the Cb and Cr planes subsampled as selected,
+// the full resolution Cb and Cr planes are never stored. Same samples as performCSCFixed followed by averaging
+// the Cb and Cr planes. The sampling factors are template parameters of the loops, so every mode gets its own
+// inner loop.
+void performCSCFused(const ppm_t *img, sample_image_t *out, ChromaSubsampling mode, SimdLevel level) {
+	CSCFunc csc = getCSCFunc(level);
+	switch (mode) {
+	case CHROMA_422:
+		convertAndDownsample<2, 1>(img, out, csc);
+		break;
+	case CHROMA_420:
+		convertAndDownsample<2, 2>(img, out, csc);
+		break;
+	case CHROMA_440:
+		convertAndDownsample<1, 2>(img, out, csc);
+		break;
+	default:
+		// nothing to average, the planes keep the full resolution
+		out->subsamplingX = 1;
+		out->subsamplingY = 1;
+		performCSCFixed(img, out, level);
+		break;
+	}
+}
+
 // Function to extract pixels from the image
 rgb_pixel_t getPixel(ppm_t *img, size_t x, size_t y) {
 	return img->data[y * img->width + x];
@@ -186,6 +481,15 @@ void getNearest8x8ImageSize(size_t width, size_t height, size_t *newWidth, size_
 	*newHeight = std::ceil(height / 8.0) * 8;
 }
 
+// Function to get the image size for padding to whole MCUs (8x8 samples of every plane)
+// e.g. 16x16 pixels for 4:2:0, so that the subsampled planes are multiples of 8 as well
+void getPaddedImageSize(size_t width, size_t height, unsigned int subsamplingX, unsigned int subsamplingY, size_t *newWidth, size_t *newHeight) {
+	size_t mcuWidth = 8 * subsamplingX;
+	size_t mcuHeight = 8 * subsamplingY;
+	*newWidth = (width + mcuWidth - 1) / mcuWidth * mcuWidth;
+	*newHeight = (height + mcuHeight - 1) / mcuHeight * mcuHeight;
+}
+
 // Function for Level Shifting
 void substractfromAll(ppm_d_t *img, double val) {
 	for (size_t i = 0; i < img->width * img->height; ++i) {
@@ -232,6 +536,58 @@ void addReversedPadding(ppm_t *img, size_t oldWidth, size_t oldHeight) {
 	}
 }
 
+// Function to copy the samples to a larger image and fill the new area with mirrored samples
+// Same padding as copyToLargerImage followed by addReversedPadding, for every plane
+// (both images have the same subsampling and components)
+void copyToLargerSampleImage(const sample_image_t *img, sample_image_t *newImg) {
+	for (size_t c = 0; c < img->numComponents; ++c) {
+		const int8_t *plane = getSamplePlane(img, c);
+		int8_t *newPlane = getSamplePlane(newImg, c);
+		size_t width = getPlaneSize(img->width, img->subsamplingX, c);
+		size_t height = getPlaneSize(img->height, img->subsamplingY, c);
+		size_t newWidth = getPlaneSize(newImg->width, newImg->subsamplingX, c);
+		size_t newHeight = getPlaneSize(newImg->height, newImg->subsamplingY, c);
+		for (size_t y = 0; y < newHeight; ++y) {
+			// rows below the image repeat the rows above the edge in reverse order
+			// (images smaller than the padding repeat their first row or column)
+			size_t srcY = (y < height) ? y : (y < 2 * height ? 2 * height - y - 1 : 0);
+			const int8_t *row = plane + srcY * width;
+			int8_t *newRow = newPlane + y * newWidth;
+			memcpy(newRow, row, width);
+			for (size_t x = width; x < newWidth; ++x) {
+				newRow[x] = row[x < 2 * width ? 2 * width - x - 1 : 0];
+			}
+		}
+	}
+}
+
+// Function to convert the level shifted samples back to an interleaved image (e.g. to write it to a file)
+// Subsampled Cb and Cr samples are repeated for every pixel they cover, grayscale images are written as gray pixels
+void copySamplesToUIntImage(const sample_image_t *img, ppm_t *newImg) {
+	const int8_t *planeY = getSamplePlane(img, 0);
+	if (img->numComponents == 1) {
+		for (size_t i = 0; i < img->width * img->height; ++i) {
+			uint8_t value = (uint8_t)(planeY[i] + 128);
+			newImg->data[i].r = value;
+			newImg->data[i].g = value;
+			newImg->data[i].b = value;
+		}
+		return;
+	}
+	const int8_t *planeCb = getSamplePlane(img, 1);
+	const int8_t *planeCr = getSamplePlane(img, 2);
+	size_t chromaWidth = getPlaneSize(img->width, img->subsamplingX, 1);
+	for (size_t y = 0; y < img->height; ++y) {
+		for (size_t x = 0; x < img->width; ++x) {
+			size_t i = y * img->width + x;
+			size_t chromaIndex = (y / img->subsamplingY) * chromaWidth + x / img->subsamplingX;
+			newImg->data[i].r = (uint8_t)(planeY[i] + 128);
+			newImg->data[i].g = (uint8_t)(planeCb[chromaIndex] + 128);
+			newImg->data[i].b = (uint8_t)(planeCr[chromaIndex] + 128);
+		}
+	}
+}
+
 // Function to convert the uint to double image
 void copyUIntToDoubleImage(ppm_t *img, ppm_d_t *newImg) {
 	for (size_t y = 0; y < img->height; ++y) {
@@ -310,43 +666,263 @@ void performDCT2(ppm_d_t *img) {
 	}
 }
 
-// Function to perform DCT on a single 8x8 block (MCU)
-void performDCTBlock(ppm_d_t *img, size_t startX, size_t startY) {
-	// perform DCT on each channel
+// Function to evaluate the DCT formula on the 64 samples of one channel of a block (row-major)
+static void performDCTFormula(const double block[64], double coeffs[64]) {
 	for (size_t u = 0; u < 8; ++u) {
 		for (size_t v = 0; v < 8; ++v) {
 			double alphaU = (u == 0) ? 1.0 / std::sqrt(2) : 1.0;
 			double alphaV = (v == 0) ? 1.0 / std::sqrt(2) : 1.0;
 
-			double sumR = 0.0;
-			double sumG = 0.0;
-			double sumB = 0.0;
-
-			for (size_t y = startY; y < startY + 8; ++y) {
-				size_t eff_y = y - startY;
-				for (size_t x = startX; x < startX + 8; ++x) {
-					rgb_pixel_d_t *pixel = &img->data[y * img->width + x];
-					size_t eff_x = x - startX;
-					sumR += pixel->r * std::cos((2 * eff_x + 1) * u * M_PI / 16.0) * std::cos((2 * eff_y + 1) * v * M_PI / 16.0);
-					sumG += pixel->g * std::cos((2 * eff_x + 1) * u * M_PI / 16.0) * std::cos((2 * eff_y + 1) * v * M_PI / 16.0);
-					sumB += pixel->b * std::cos((2 * eff_x + 1) * u * M_PI / 16.0) * std::cos((2 * eff_y + 1) * v * M_PI / 16.0);
+			double sum = 0.0;
+			for (size_t y = 0; y < 8; ++y) {
+				for (size_t x = 0; x < 8; ++x) {
+					sum += block[y * 8 + x] * std::cos((2 * x + 1) * u * M_PI / 16.0) * std::cos((2 * y + 1) * v * M_PI / 16.0);
 				}
 			}
 
-			sumR *= (alphaU * alphaV / 4.0);
-			sumG *= (alphaU * alphaV / 4.0);
-			sumB *= (alphaU * alphaV / 4.0);
+			coeffs[v * 8 + u] = sum * (alphaU * alphaV / 4.0);
+		}
+	}
+}
 
-			int x_val = startX + u;
-			int y_val = startY + v;
-			rgb_pixel_d_t *pixel = &img->data[y_val * img->width + x_val];
-			pixel->r = sumR;
-			pixel->g = sumG;
-			pixel->b = sumB;
+// Function to perform DCT on a single 8x8 block (MCU)
+void performDCTBlock(ppm_d_t *img, size_t startX, size_t startY) {
+	// the coefficients are collected first, the input block must not be overwritten while it is read
+	double block[3][64];
+	double coeffs[3][64];
+
+	for (size_t y = 0; y < 8; ++y) {
+		rgb_pixel_d_t *row = &img->data[(startY + y) * img->width + startX];
+		for (size_t x = 0; x < 8; ++x) {
+			block[0][y * 8 + x] = row[x].r;
+			block[1][y * 8 + x] = row[x].g;
+			block[2][y * 8 + x] = row[x].b;
+		}
+	}
+
+	// perform DCT on each channel
+	for (size_t c = 0; c < 3; ++c) {
+		performDCTFormula(block[c], coeffs[c]);
+	}
+
+	for (size_t v = 0; v < 8; ++v) {
+		rgb_pixel_d_t *row = &img->data[(startY + v) * img->width + startX];
+		for (size_t u = 0; u < 8; ++u) {
+			row[u].r = coeffs[0][v * 8 + u];
+			row[u].g = coeffs[1][v * 8 + u];
+			row[u].b = coeffs[2][v * 8 + u];
+		}
+	}
+}
+
+// Function to run a fused DCT and quantization on every 8x8 block of a plane (raster order)
+// quantizeBlock gets the 64 samples of a block (row-major) and writes its 64 quantized coefficients
+template<typename BlockFunc>
+static void quantizePlaneBlocks(const int8_t *plane, size_t width, size_t height, int16_t *coeffs, BlockFunc quantizeBlock) {
+	int block[64];
+	for (size_t y = 0; y < height; y += 8) {
+		for (size_t x = 0; x < width; x += 8) {
+			for (size_t v = 0; v < 8; ++v) {
+				const int8_t *row = plane + (y + v) * width + x;
+				for (size_t u = 0; u < 8; ++u) {
+					block[v * 8 + u] = row[u];
+				}
+			}
+			quantizeBlock(block, coeffs);
+			coeffs += 64;
+		}
+	}
+}
+
+// Function to perform the DCT with the selected method and the quantization in one pass over the sample planes
+// The blocks are read from the (subsampled) planes of the level shifted samples, every plane a multiple of 8
+// in size, and written to the coefficient planes of the same geometry. Every method is within 1 of the
+// reference DCT followed by the quantization (see checkDCTAccuracy).
+void performDCTQuantizationPlanar(const sample_image_t *samples, const unsigned int quant_mat_lum[8][8], const unsigned int quant_mat_chrom[8][8], DCTMethod method, SimdLevel level, coeff_image_t *quantized) {
+	for (size_t c = 0; c < samples->numComponents; ++c) {
+		const unsigned int (*quant)[8] = (c == 0) ? quant_mat_lum : quant_mat_chrom;
+		const int8_t *plane = getSamplePlane(samples, c);
+		size_t width = getPlaneSize(samples->width, samples->subsamplingX, c);
+		size_t height = getPlaneSize(samples->height, samples->subsamplingY, c);
+		int16_t *coeffs = getCoeffBlock(quantized, c, 0);
+
+		switch (method) {
+		case DCT_AAN:
+		case DCT_SIMD: {
+			// the quantization is folded into the post-scale of the AAN DCT (see getDCTQuantScale),
+			// aan runs the scalar block DCT, simd the one of the selected instruction set
+			float scale[64];
+			getDCTQuantScale(quant, scale);
+			DCTQuantBlockFunc dctQuantBlock = getDCTQuantBlockFunc(method == DCT_AAN ? SIMD_SCALAR : level);
+			quantizePlaneBlocks(plane, width, height, coeffs, [&scale, dctQuantBlock](const int *block, int16_t *out) {
+				float f[64];
+				float q[64];
+				for (size_t i = 0; i < 64; ++i) {
+					f[i] = (float)block[i];
+				}
+				dctQuantBlock(f, q, scale, true);
+				for (size_t i = 0; i < 64; ++i) {
+					out[i] = (int16_t)q[i];
+				}
+			});
+			break;
+		}
+		case DCT_INT: {
+			DCTIntBlockFunc dctIntBlock = getDCTIntBlockFunc(level);
+			quantizePlaneBlocks(plane, width, height, coeffs, [quant, dctIntBlock](const int *block, int16_t *out) {
+				int d[64];
+				dctIntBlock(block, d);
+				for (size_t i = 0; i < 64; ++i) {
+					out[i] = (int16_t)quantizeIntCoefficient(d[i], quant[i / 8][i % 8]);
+				}
+			});
+			break;
+		}
+		default:
+			quantizePlaneBlocks(plane, width, height, coeffs, [quant](const int *block, int16_t *out) {
+				double d[64];
+				double dct[64];
+				for (size_t i = 0; i < 64; ++i) {
+					d[i] = block[i];
+				}
+				performDCTFormula(d, dct);
+				for (size_t i = 0; i < 64; ++i) {
+					out[i] = (int16_t)std::round(dct[i] / quant[i / 8][i % 8]);
+				}
+			});
+			break;
+		}
+	}
+}
+
+// Function to check the fused DCT and quantization of a method (performDCTQuantizationPlanar) against the
+// reference DCT on random level shifted blocks, for every instruction set supported by the CPU
+// A quantized coefficient may differ from the reference by 1 (a product close to a halfway case),
+// the SIMD versions have to give the same coefficients as the scalar version. The blocks are checked
+// without quantization (all ones, the strictest case) and with the given quantization matrices.
+bool checkDCTAccuracy(DCTMethod method, const unsigned int quant_mat_lum[8][8], const unsigned int quant_mat_chrom[8][8]) {
+	const size_t width = 32;
+	const size_t height = 16;
+	std::vector<int8_t> sampleData(3 * width * height);
+	sample_image_t samples = {width, height, 1, 1, 3, sampleData.data()};
+
+	// local generator with a fixed seed: the same test image on every platform, no global rand() state is touched
+	std::mt19937 rng(1);
+	for (size_t i = 0; i < sampleData.size(); ++i) {
+		sampleData[i] = (int8_t)((int)(rng() % 256) - 128);
+	}
+	// the last block holds the extreme values
+	for (size_t y = height - 8; y < height; ++y) {
+		for (size_t x = width - 8; x < width; ++x) {
+			getSamplePlane(&samples, 0)[y * width + x] = ((x + y) % 2) ? 127 : -128;
+			getSamplePlane(&samples, 1)[y * width + x] = -128;
+			getSamplePlane(&samples, 2)[y * width + x] = 127;
+		}
+	}
+
+	unsigned int ones[8][8];
+	for (size_t v = 0; v < 8; ++v) {
+		for (size_t u = 0; u < 8; ++u) {
+			ones[v][u] = 1;
 		}
 	}
+
+	// only the SIMD and the integer DCT have a version per instruction set
+	SimdLevel maxLevel = (method == DCT_SIMD || method == DCT_INT) ? detectSimdLevel() : SIMD_SCALAR;
+	bool passed = true;
+	for (int quantized = 0; quantized <= 1; ++quantized) {
+		const unsigned int (*quantLum)[8] = quantized ? quant_mat_lum : ones;
+		const unsigned int (*quantChrom)[8] = quantized ? quant_mat_chrom : ones;
+
+		std::vector<int16_t> referenceData(sampleData.size());
+		std::vector<int16_t> scalarData(sampleData.size());
+		coeff_image_t reference = {width, height, 1, 1, 3, referenceData.data()};
+		coeff_image_t scalar = {width, height, 1, 1, 3, scalarData.data()};
+		performDCTQuantizationPlanar(&samples, quantLum, quantChrom, DCT_REFERENCE, SIMD_SCALAR, &reference);
+		performDCTQuantizationPlanar(&samples, quantLum, quantChrom, method, SIMD_SCALAR, &scalar);
+
+		for (int level = SIMD_SCALAR; level <= maxLevel; ++level) {
+			std::vector<int16_t> data(sampleData.size());
+			coeff_image_t coeffs = {width, height, 1, 1, 3, data.data()};
+			performDCTQuantizationPlanar(&samples, quantLum, quantChrom, method, (SimdLevel)level, &coeffs);
+
+			int maxError = 0;
+			size_t mismatches = 0;
+			for (size_t i = 0; i < data.size(); ++i) {
+				maxError = std::max(maxError, std::abs(data[i] - referenceData[i]));
+				if (data[i] != scalarData[i]) {
+					++mismatches;
+				}
+			}
+			std::cout << "DCT accuracy check (" << getDCTMethodName(method) << ", " << getSimdLevelName((SimdLevel)level) << ", " << (quantized ? "quantized" : "unquantized") << "): max. coefficient error " << maxError << ", coefficients different from scalar " << mismatches << std::endl;
+			passed = passed && maxError <= 1 && mismatches == 0;
+		}
+	}
+	return passed;
+}
+
+// Function to get the name of a DCT method as used on the command line
+const char* getDCTMethodName(DCTMethod method) {
+	switch (method) {
+	case DCT_AAN:
+		return "aan";
+	case DCT_SIMD:
+		return "simd";
+	case DCT_INT:
+		return "int";
+	default:
+		return "ref";
+	}
+}
+
+// Function to get the name of a GPU DCT kernel as used on the command line
+const char* getGPUDCTKernelName(GPUDCTKernel kernel) {
+	switch (kernel) {
+	case GPU_DCT_TILED:
+		return "tiled";
+	default:
+		return "naive";
+	}
+}
+
+// Function to get the name of a GPU pipeline as used on the command line
+const char* getGPUPipelineName(GPUPipeline pipeline) {
+	switch (pipeline) {
+	case GPU_PIPELINE_FUSED:
+		return "fused";
+	default:
+		return "stages";
+	}
 }
 
+// Function to get the name of a chroma subsampling mode as used on the command line
+const char* getChromaSubsamplingName(ChromaSubsampling mode) {
+	switch (mode) {
+	case CHROMA_444:
+		return "444";
+	case CHROMA_422:
+		return "422";
+	case CHROMA_440:
+		return "440";
+	default:
+		return "420";
+	}
+}
+
+// Function to get the horizontal and vertical Y samples per Cb and Cr sample of a chroma subsampling mode
+// (the sampling factors of Y in the frame header, Cb and Cr are sampled 1x1)
+void getChromaSubsamplingFactors(ChromaSubsampling mode, unsigned int *subsamplingX, unsigned int *subsamplingY) {
+	*subsamplingX = (mode == CHROMA_422 || mode == CHROMA_420) ? 2 : 1;
+	*subsamplingY = (mode == CHROMA_440 || mode == CHROMA_420) ? 2 : 1;
+}
+
+// Function to get the chroma subsampling mode of the given factors
+ChromaSubsampling getChromaSubsampling(unsigned int subsamplingX, unsigned int subsamplingY) {
+	if (subsamplingX == 2) {
+		return (subsamplingY == 2) ? CHROMA_420 : CHROMA_422;
+	}
+	return (subsamplingY == 2) ? CHROMA_440 : CHROMA_444;
+}
 
 // Function to preview the image from the ppm_t struct
 void previewImage(ppm_t *img, size_t startX = 0, size_t startY = 0, size_t lengthX = 8, size_t lengthY = 8, std::string msg) {
@@ -450,22 +1026,6 @@ void previewImageLinearD(std::vector<float>& v, const unsigned int width, const
 	}
 }
 
-// Function to perform quantization on the image
-void performQuantization(ppm_d_t *img, const unsigned int quant_mat_lum[8][8], const unsigned int quant_mat_chrom[8][8]) {
-	for (size_t y = 0; y < img->height; y += 8) {
-		for (size_t x = 0; x < img->width; x += 8) {
-			for (size_t v = 0; v < 8; ++v) {
-				for (size_t u = 0; u < 8; ++u) {
-					rgb_pixel_d_t *pixel = &img->data[(y + v) * img->width + (x + u)];
-					pixel->r = std::round(pixel->r / quant_mat_lum[v][u]);
-					pixel->g = std::round(pixel->g / quant_mat_chrom[v][u]);
-					pixel->b = std::round(pixel->b / quant_mat_chrom[v][u]);
-				}
-			}
-		}
-	}
-}
-
 // Function to perform quantization on the image - Alternate function
 void performQuantizationSimple(ppm_d_t *img, const unsigned int quant_mat_lum[8][8], const unsigned int quant_mat_chrom[8][8]) {
 	for (size_t y = 0; y < img->height; y += 1) {
@@ -604,8 +1164,11 @@ void RLEBlockAC(int zigzag_array[], std::vector<int>& rle_vector) {
 			count = 0;
 		}
     }
-	rle_vector.push_back(0);
-    rle_vector.push_back(0);
+	// End of block, unless the last coefficient is non-zero
+	if (lastNonZeroIndex < 63) {
+		rle_vector.push_back(0);
+		rle_vector.push_back(0);
+	}
 }
 
 // Function to perform RLE on all the MCU blocks
@@ -619,45 +1182,43 @@ void performRLE(int zigzag_array[][64], std::vector<std::vector<int>>& rle_vecto
 	}
 }
 
-// Function to get the category from the given value
-const int16_t getValueCategory(const int16_t value) {
-    if (value == 0x0000)
-        return 0;
-    return std::log2(std::abs(value)) + 1;
-}
-
-// Function to convert the value to a bit stream
-const std::string valueToBitString(const int16_t value) {
-    if (value == 0x0000)
-        //return "0"; 
-        return "";
-    
-    int16_t val = value;
-    int bits = ( std::log2( std::abs( value ) ) ) + 1;
-    //std::cout << "Bits: " << bits << ", ";
-    std::string bitStr( bits, '0' );
-    
-    if (val < 0) {
-        int16_t delta = 0xFFFF >> (16 - bits);
-        val += delta;
-        val = std::abs( val );
-    }
-    
-    int i = bitStr.size() - 1;
-    while (val > 0) {
-        bitStr[i--] = '0' + val % 2;
-        val /= 2;
-    }
-    
-    return bitStr;
+// Function to compare one packed Huffman code against its '0'/'1' string
+static bool compareHuffmanCode(const HuffmanCodeTable& table, int symbol, const std::string& bitStr) {
+	uint32_t bits = 0;
+	for (size_t i = 0; i < bitStr.size(); ++i) {
+		bits = (bits << 1) | (bitStr[i] - '0');
+	}
+	return table.length[symbol] == bitStr.size() && table.code[symbol] == bits;
+}
+
+// Function to check that the packed Huffman tables match the string tables in huffman.hpp
+bool checkHuffmanTables() {
+	bool ok = true;
+	for (size_t category = 0; category < DC_LUMA_HUFF_CODES.size(); ++category) {
+		ok &= compareHuffmanCode(DC_LUMA_HUFF_TABLE, category, DC_LUMA_HUFF_CODES[category]);
+		ok &= compareHuffmanCode(DC_CHROMA_HUFF_TABLE, category, DC_CHROMA_HUFF_CODES[category]);
+	}
+	for (size_t run = 0; run < 16; ++run) {
+		for (size_t size = 0; size < AC_LUMA_HUFF_CODES[run].size(); ++size) {
+			int symbol = (run << 4) | size;
+			// the "NULL" entries are not valid symbols and have no code
+			if (AC_LUMA_HUFF_CODES[run][size] == "NULL") {
+				ok &= AC_LUMA_HUFF_TABLE.length[symbol] == 0 && AC_CHROMA_HUFF_TABLE.length[symbol] == 0;
+				continue;
+			}
+			ok &= compareHuffmanCode(AC_LUMA_HUFF_TABLE, symbol, AC_LUMA_HUFF_CODES[run][size]);
+			ok &= compareHuffmanCode(AC_CHROMA_HUFF_TABLE, symbol, AC_CHROMA_HUFF_CODES[run][size]);
+		}
+	}
+	return ok;
 }
 
 // Function to implement the Huffman encoding
-std::string HuffmanEncoder(int zigzag_array[][64], 
+void HuffmanEncoder(int zigzag_array[][64], 
 					std::vector<std::vector<int>>& rle_vector,
-					int numRowsPerChannel) {
+					int numRowsPerChannel,
+					BitWriter& writer) {
 
-	std::string m_scandata = "";
 	int dc_components[numRowsPerChannel][3];
 
 	// Take the difference between the first element of two consecutive MCU blocks 
@@ -670,83 +1231,609 @@ std::string HuffmanEncoder(int zigzag_array[][64],
 			dc_components[i][chan] = zigzag_array[i + (numRowsPerChannel * chan)][0] - lastVal[chan];
 			lastVal[chan] = zigzag_array[i + (numRowsPerChannel * chan)][0];
 
-			auto category = getValueCategory(dc_components[i][chan]);
-			auto bitString = valueToBitString(dc_components[i][chan]);
-
-			if (chan == 0) {
-				m_scandata += DC_LUMA_HUFF_CODES[category] + bitString;
-			} else {
-				m_scandata += DC_CHROMA_HUFF_CODES[category] + bitString;
-			}
+			// huffman code of the category followed by the magnitude bits (at most 16 + 11 bits)
+			value_bits_t dc = valueToBits(dc_components[i][chan]);
+			const HuffmanCodeTable& dcTable = (chan == 0) ? DC_LUMA_HUFF_TABLE : DC_CHROMA_HUFF_TABLE;
+			writer.writeBits(((uint32_t)dcTable.code[dc.length] << dc.length) | dc.bits, dcTable.length[dc.length] + dc.length);
 
 			// Encode the AC coefficients
 			for (size_t j = 0; j < rle_vector[i + (numRowsPerChannel * chan)].size(); j+=2) {
 				auto zero_run = rle_vector[i + (numRowsPerChannel * chan)][j];
 				auto value = rle_vector[i + (numRowsPerChannel * chan)][j+1];
-				auto category = getValueCategory(value);
-				auto bitString = valueToBitString( value );
+				value_bits_t ac = valueToBits(value);
 
-				if (chan == 0) {
-					m_scandata += AC_LUMA_HUFF_CODES[zero_run][category] + bitString;
-				} else {
-					m_scandata += AC_CHROMA_HUFF_CODES[zero_run][category] + bitString;
-				}
+				const HuffmanCodeTable& acTable = (chan == 0) ? AC_LUMA_HUFF_TABLE : AC_CHROMA_HUFF_TABLE;
+				int symbol = (zero_run << 4) | ac.length;
+				writer.writeBits(((uint32_t)acTable.code[symbol] << ac.length) | ac.bits, acTable.length[symbol] + ac.length);
 			}
 		}
-	}		
-	return m_scandata;			
+	}
+	// pad the last byte with 1-bits
+	writer.flush();
 }
 
-// Function to perform the copy Image to vector
-void copyImageToVector(ppm_t *img, std::vector <cl_uint>& v) {
-	for (size_t idx = 0; idx < img->width * img->height; ++idx) {
-		v[idx] = img->data[idx].r;
-		v[idx + img->width * img->height] = img->data[idx].g;
-		v[idx + img->width * img->height * 2] = img->data[idx].b;
+// Function to zigzag scan, run length encode and huffman encode one 8x8 block in a single pass
+// The block is given in row major order, or already in zigzag order if inZigZagOrder is set
+template <bool inZigZagOrder>
+static inline void encodeBlock(const int16_t *block, int& lastDC, const HuffmanCodeTable& dcTable, const HuffmanCodeTable& acTable, BitWriter& writer) {
+	// DC coefficient: difference to the DC coefficient of the previous block of the same channel
+	value_bits_t dc = valueToBits(block[0] - lastDC);
+	lastDC = block[0];
+	writer.writeBits(((uint32_t)dcTable.code[dc.length] << dc.length) | dc.bits, dcTable.length[dc.length] + dc.length);
+
+	// AC coefficients: (zero run, category) symbols followed by the magnitude bits
+	unsigned int run = 0;
+	for (size_t k = 1; k < 64; ++k) {
+		int value = block[inZigZagOrder ? k : zigzag_order[k]];
+		if (value == 0) {
+			++run;
+			continue;
+		}
+		// runs longer than 15 zeros are split with ZRL (16 zeros) symbols
+		while (run > 15) {
+			writer.writeBits(acTable.code[0xF0], acTable.length[0xF0]);
+			run -= 16;
+		}
+		value_bits_t ac = valueToBits(value);
+		unsigned int symbol = (run << 4) | ac.length;
+		writer.writeBits(((uint32_t)acTable.code[symbol] << ac.length) | ac.bits, acTable.length[symbol] + ac.length);
+		run = 0;
+	}
+
+	// End of block, unless the last coefficient is non-zero
+	if (run > 0) {
+		writer.writeBits(acTable.code[0x00], acTable.length[0x00]);
 	}
 }
 
-// Function to implement Reverse Padding for GPU
-void copyOntoLargerVectorWithPadding(std::vector <cl_uint>& vInput, std::vector <cl_uint>& vOutput, const unsigned int oldWidth, const unsigned int oldHeight, const unsigned int newWidth, const unsigned int newHeight) {
-	// copy the original image
-	for (size_t y = 0; y < oldHeight; ++y) {
-		for (size_t x = 0; x < oldWidth; ++x) {
-			vOutput[y * newWidth + x] = vInput[y * oldWidth + x];
-			vOutput[y * newWidth + x + newWidth * newHeight] = vInput[y * oldWidth + x + oldWidth * oldHeight];
-			vOutput[y * newWidth + x + newWidth * newHeight * 2] = vInput[y * oldWidth + x + oldWidth * oldHeight * 2];
+// Function to count the huffman symbols of one 8x8 block (same symbols as encodeBlock)
+// The block is given in row major order, or already in zigzag order if inZigZagOrder is set
+template <bool inZigZagOrder>
+static inline void countBlockSymbols(const int16_t *block, int& lastDC, uint32_t *dcHistogram, uint32_t *acHistogram) {
+	dcHistogram[getValueCategory(block[0] - lastDC)]++;
+	lastDC = block[0];
+
+	unsigned int run = 0;
+	for (size_t k = 1; k < 64; ++k) {
+		int value = block[inZigZagOrder ? k : zigzag_order[k]];
+		if (value == 0) {
+			++run;
+			continue;
 		}
+		acHistogram[0xF0] += run >> 4;
+		acHistogram[((run & 15) << 4) | getValueCategory(value)]++;
+		run = 0;
+	}
+	if (run > 0) {
+		acHistogram[0x00]++;
 	}
+}
 
-	// add padding to the right
-	for (size_t y = 0; y < oldHeight; ++y) {
-		for (size_t x = oldWidth; x < newWidth; ++x) {
-			int diff = x - oldWidth + 1;
-			vOutput[y * newWidth + x] = vInput[y * oldWidth + oldWidth - diff];
-			vOutput[y * newWidth + x + newWidth * newHeight] = vInput[y * oldWidth + oldWidth - diff + oldWidth * oldHeight];
-			vOutput[y * newWidth + x + newWidth * newHeight * 2] = vInput[y * oldWidth + oldWidth - diff + oldWidth * oldHeight * 2];
+// Function to get the number of MCUs in a row of the quantized image
+// An MCU covers one 8x8 block of every chroma plane and subsamplingX * subsamplingY blocks of the Y plane
+// (one block for grayscale images, subsampling 1, 1)
+static inline size_t getMCUsPerRow(const coeff_image_t *coeffs) {
+	return coeffs->width / (8 * coeffs->subsamplingX);
+}
+
+// Function to get the number of MCUs of the quantized image
+static inline size_t getNumMCUs(const coeff_image_t *coeffs) {
+	return getMCUsPerRow(coeffs) * (coeffs->height / (8 * coeffs->subsamplingY));
+}
+
+// Function to get the index of the n-th Y block of an MCU in the Y plane of a quantized image
+// with SX x SY Y blocks per MCU
+// The Y blocks of an MCU are coded row by row (e.g. top left, top right, bottom left, bottom right for 4:2:0)
+template <unsigned int SX, unsigned int SY>
+static inline size_t getMCULumaBlock(size_t lumaBlocksPerRow, size_t mcusPerRow, size_t mcu, size_t n) {
+	size_t blockX = (mcu % mcusPerRow) * SX + n % SX;
+	size_t blockY = (mcu / mcusPerRow) * SY + n / SX;
+	return blockY * lumaBlocksPerRow + blockX;
+}
+
+// Function to get the DC coefficients of the channels of an MCU of the quantized image
+// (of the last Y block for the Y channel), i.e. the DC predictors after the MCU
+static inline void getMCUDC(const coeff_image_t *coeffs, size_t mcu, int dc[3]) {
+	size_t mcusPerRow = getMCUsPerRow(coeffs);
+	size_t blockX = (mcu % mcusPerRow + 1) * coeffs->subsamplingX - 1;
+	size_t blockY = (mcu / mcusPerRow + 1) * coeffs->subsamplingY - 1;
+	dc[0] = getCoeffBlock(coeffs, 0, blockY * getCoeffBlocksPerRow(coeffs, 0) + blockX)[0];
+	if (coeffs->numComponents == 3) {
+		dc[1] = getCoeffBlock(coeffs, 1, mcu)[0];
+		dc[2] = getCoeffBlock(coeffs, 2, mcu)[0];
+	}
+}
+
+// Entropy coding of the MCUs [firstMCU, endMCU) of a quantized image, see encodeMCUs
+typedef void (*EncodeMCUsFunc)(const coeff_image_t *coeffs, size_t firstMCU, size_t endMCU, int lastDC[3], const HuffmanTableSet& tables, BitWriter& writer);
+
+// Symbol counting of the MCUs [firstMCU, endMCU) of a quantized image, see countMCUSymbols
+typedef void (*CountMCUSymbolsFunc)(const coeff_image_t *coeffs, size_t firstMCU, size_t endMCU, unsigned int restartInterval, int lastDC[3], uint32_t *histograms);
+
+// Function to entropy code the MCUs [firstMCU, endMCU) of the quantized image in raster order
+// The blocks are in row major order, or already in zigzag order if inZigZagOrder is set
+// lastDC holds the DC predictors of the three channels and is updated
+// SX x SY are the Y blocks per MCU, i.e. the sampling factors of the image (see getEncodeMCUsFunc)
+template <bool inZigZagOrder, unsigned int SX, unsigned int SY>
+static void encodeMCUs(const coeff_image_t *coeffs, size_t firstMCU, size_t endMCU, int lastDC[3], const HuffmanTableSet& tables, BitWriter& writer) {
+	size_t lumaBlocksPerRow = getCoeffBlocksPerRow(coeffs, 0);
+	size_t mcusPerRow = getMCUsPerRow(coeffs);
+	for (size_t mcu = firstMCU; mcu < endMCU; ++mcu) {
+		for (size_t n = 0; n < SX * SY; ++n) {
+			encodeBlock<inZigZagOrder>(getCoeffBlock(coeffs, 0, getMCULumaBlock<SX, SY>(lumaBlocksPerRow, mcusPerRow, mcu, n)), lastDC[0], tables.codes[HUFF_DC_LUMA], tables.codes[HUFF_AC_LUMA], writer);
 		}
+		encodeBlock<inZigZagOrder>(getCoeffBlock(coeffs, 1, mcu), lastDC[1], tables.codes[HUFF_DC_CHROMA], tables.codes[HUFF_AC_CHROMA], writer);
+		encodeBlock<inZigZagOrder>(getCoeffBlock(coeffs, 2, mcu), lastDC[2], tables.codes[HUFF_DC_CHROMA], tables.codes[HUFF_AC_CHROMA], writer);
 	}
+}
 
-	// add padding to the bottom
-	for (size_t y = oldHeight; y < newHeight; ++y) {
-		for (size_t x = 0; x < newWidth; ++x) {
-			int diff = y - oldHeight + 1;
-			vOutput[y * newWidth + x] = vInput[(oldHeight - diff) * oldWidth + x];
-			vOutput[y * newWidth + x + newWidth * newHeight] = vInput[(oldHeight - diff) * oldWidth + x + oldWidth * oldHeight];
-			vOutput[y * newWidth + x + newWidth * newHeight * 2] = vInput[(oldHeight - diff) * oldWidth + x + oldWidth * oldHeight * 2];
+// Function to count the huffman symbols of the MCUs [firstMCU, endMCU) of the quantized image (row major blocks)
+// into the four histograms of 256 bins (ordered as in HuffmanTableSet), same traversal as encodeMCUs
+template <unsigned int SX, unsigned int SY>
+static void countMCUSymbols(const coeff_image_t *coeffs, size_t firstMCU, size_t endMCU, unsigned int restartInterval, int lastDC[3], uint32_t *hist) {
+	size_t lumaBlocksPerRow = getCoeffBlocksPerRow(coeffs, 0);
+	size_t mcusPerRow = getMCUsPerRow(coeffs);
+	for (size_t mcu = firstMCU; mcu < endMCU; ++mcu) {
+		// the DC predictors start at zero in every restart interval
+		if (restartInterval > 0 && mcu % restartInterval == 0) {
+			lastDC[0] = lastDC[1] = lastDC[2] = 0;
+		}
+		for (size_t n = 0; n < SX * SY; ++n) {
+			countBlockSymbols<false>(getCoeffBlock(coeffs, 0, getMCULumaBlock<SX, SY>(lumaBlocksPerRow, mcusPerRow, mcu, n)), lastDC[0], hist + HUFF_DC_LUMA * 256, hist + HUFF_AC_LUMA * 256);
+		}
+		countBlockSymbols<false>(getCoeffBlock(coeffs, 1, mcu), lastDC[1], hist + HUFF_DC_CHROMA * 256, hist + HUFF_AC_CHROMA * 256);
+		countBlockSymbols<false>(getCoeffBlock(coeffs, 2, mcu), lastDC[2], hist + HUFF_DC_CHROMA * 256, hist + HUFF_AC_CHROMA * 256);
+	}
+}
+
+// Function to entropy code the MCUs [firstMCU, endMCU) of a grayscale image: the single component scan
+// codes the blocks of the Y plane in raster order, one block per MCU (see encodeMCUs)
+template <bool inZigZagOrder>
+static void encodeGrayscaleMCUs(const coeff_image_t *coeffs, size_t firstMCU, size_t endMCU, int lastDC[3], const HuffmanTableSet& tables, BitWriter& writer) {
+	for (size_t mcu = firstMCU; mcu < endMCU; ++mcu) {
+		encodeBlock<inZigZagOrder>(getCoeffBlock(coeffs, 0, mcu), lastDC[0], tables.codes[HUFF_DC_LUMA], tables.codes[HUFF_AC_LUMA], writer);
+	}
+}
+
+// Function to count the huffman symbols of the MCUs [firstMCU, endMCU) of a grayscale image (see countMCUSymbols)
+// Only the luminance histograms are filled
+static void countGrayscaleMCUSymbols(const coeff_image_t *coeffs, size_t firstMCU, size_t endMCU, unsigned int restartInterval, int lastDC[3], uint32_t *hist) {
+	for (size_t mcu = firstMCU; mcu < endMCU; ++mcu) {
+		if (restartInterval > 0 && mcu % restartInterval == 0) {
+			lastDC[0] = 0;
+		}
+		countBlockSymbols<false>(getCoeffBlock(coeffs, 0, mcu), lastDC[0], hist + HUFF_DC_LUMA * 256, hist + HUFF_AC_LUMA * 256);
+	}
+}
+
+// Function to get the MCU coder specialized for the sampling factors of the quantized image
+// The mode is picked once per image, the loops of every mode are unrolled at compile time
+template <bool inZigZagOrder>
+static EncodeMCUsFunc getEncodeMCUsFunc(const coeff_image_t *coeffs) {
+	if (coeffs->numComponents == 1) {
+		return encodeGrayscaleMCUs<inZigZagOrder>;
+	}
+	switch (getChromaSubsampling(coeffs->subsamplingX, coeffs->subsamplingY)) {
+	case CHROMA_444:
+		return encodeMCUs<inZigZagOrder, 1, 1>;
+	case CHROMA_422:
+		return encodeMCUs<inZigZagOrder, 2, 1>;
+	case CHROMA_440:
+		return encodeMCUs<inZigZagOrder, 1, 2>;
+	default:
+		return encodeMCUs<inZigZagOrder, 2, 2>;
+	}
+}
+
+// Function to get the symbol counter specialized for the sampling factors of the quantized image
+static CountMCUSymbolsFunc getCountMCUSymbolsFunc(const coeff_image_t *coeffs) {
+	if (coeffs->numComponents == 1) {
+		return countGrayscaleMCUSymbols;
+	}
+	switch (getChromaSubsampling(coeffs->subsamplingX, coeffs->subsamplingY)) {
+	case CHROMA_444:
+		return countMCUSymbols<1, 1>;
+	case CHROMA_422:
+		return countMCUSymbols<2, 1>;
+	case CHROMA_440:
+		return countMCUSymbols<1, 2>;
+	default:
+		return countMCUSymbols<2, 2>;
+	}
+}
+
+// Function to entropy code numMCUs MCUs split into restart intervals of restartInterval MCUs
+// Every interval is coded independently (DC predictors reset, last byte padded) into its own
+// writer, in parallel on the pool if one is given. The byte stuffed segments are then joined
+// in order with RST0..RST7 markers in between.
+template <typename EncodeRange>
+static void encodeRestartIntervals(size_t numMCUs, unsigned int restartInterval, ThreadPool *pool, EncodeRange encodeRange, BitWriter& writer) {
+	size_t numIntervals = (numMCUs + restartInterval - 1) / restartInterval;
+	std::vector<BitWriter> segments(numIntervals, BitWriter(restartInterval * 3 * 64));
+
+	auto encodeInterval = [&](size_t n) {
+		size_t first = n * restartInterval;
+		size_t end = std::min(first + restartInterval, numMCUs);
+		segments[n].clear();
+		encodeRange(first, end, segments[n]);
+		segments[n].flush();
+	};
+	if (pool) {
+		pool->parallelFor(numIntervals, encodeInterval);
+	} else {
+		for (size_t n = 0; n < numIntervals; ++n) {
+			encodeInterval(n);
+		}
+	}
+
+	for (size_t n = 0; n < numIntervals; ++n) {
+		if (n > 0) {
+			writer.writeMarker(JPEG_MARKER_RST0 + ((n - 1) & 7));
+		}
+		writer.writeBytes(segments[n].data(), segments[n].size());
+	}
+}
+
+// Function to get the 8 bits starting at bit position bitPos of a bit stream of numBits bits
+// Bits outside of the stream are zero
+static inline uint8_t getStreamByte(const uint8_t *stream, size_t numBits, long long bitPos) {
+	if (bitPos >= 0 && bitPos + 8 <= (long long)numBits) {
+		size_t i = bitPos >> 3;
+		unsigned int shift = bitPos & 7;
+		if (shift == 0) {
+			return stream[i];
+		}
+		return (uint8_t)((stream[i] << shift) | (stream[i + 1] >> (8 - shift)));
+	}
+	uint8_t value = 0;
+	for (long long pos = bitPos; pos < bitPos + 8; ++pos) {
+		value <<= 1;
+		if (pos >= 0 && pos < (long long)numBits) {
+			value |= (stream[pos >> 3] >> (7 - (pos & 7))) & 1;
+		}
+	}
+	return value;
+}
+
+// Function to entropy code numMCUs MCUs (mcusPerRow per MCU row) in parallel without restart markers
+// The MCU rows are split into chunks that are coded on the pool into unstuffed bit streams, with the
+// DC predictors seeded from the last MCU of the previous chunk (done by encodeRange). An exclusive
+// prefix sum of the chunk bit lengths gives the bit offset of every chunk, the chunks are shifted into
+// place and the stitched stream is byte stuffed. The result is identical to the serial encoder.
+template <typename EncodeRange>
+static void encodeChunksStitched(size_t numMCUs, size_t mcusPerRow, ThreadPool& pool, EncodeRange encodeRange, BitWriter& writer) {
+	size_t numRows = (numMCUs + mcusPerRow - 1) / mcusPerRow;
+	// a few chunks per thread balance rows that compress differently
+	size_t rowsPerChunk = std::max<size_t>(1, (numRows + 4 * pool.size() - 1) / (4 * pool.size()));
+	size_t numChunks = (numRows + rowsPerChunk - 1) / rowsPerChunk;
+	std::vector<BitWriter> chunks(numChunks, BitWriter(rowsPerChunk * mcusPerRow * 3 * 64, false));
+	std::vector<size_t> chunkBits(numChunks);
+
+	// code the chunks into unstuffed bit streams
+	pool.parallelFor(numChunks, [&](size_t n) {
+		size_t first = n * rowsPerChunk * mcusPerRow;
+		size_t end = std::min(first + rowsPerChunk * mcusPerRow, numMCUs);
+		chunks[n].clear();
+		encodeRange(first, end, chunks[n]);
+		chunkBits[n] = chunks[n].bitCount();
+		chunks[n].flush();
+	});
+
+	// exclusive prefix sum of the chunk bit lengths
+	std::vector<size_t> chunkOffset(numChunks);
+	size_t totalBits = 0;
+	for (size_t n = 0; n < numChunks; ++n) {
+		chunkOffset[n] = totalBits;
+		totalBits += chunkBits[n];
+	}
+
+	// stitch the chunks: every byte that lies completely inside one chunk is written by that chunk
+	size_t numBytes = (totalBits + 7) / 8;
+	std::vector<uint8_t> stream(numBytes, 0);
+	pool.parallelFor(numChunks, [&](size_t n) {
+		size_t firstByte = (chunkOffset[n] + 7) / 8;
+		size_t endByte = (chunkOffset[n] + chunkBits[n]) / 8;
+		for (size_t b = firstByte; b < endByte; ++b) {
+			stream[b] = getStreamByte(chunks[n].data(), chunkBits[n], (long long)(8 * b) - (long long)chunkOffset[n]);
+		}
+	});
+	// the bytes shared by neighbouring chunks are merged afterwards
+	for (size_t n = 0; n < numChunks; ++n) {
+		size_t begin = chunkOffset[n];
+		size_t end = chunkOffset[n] + chunkBits[n];
+		if (begin & 7) {
+			stream[begin / 8] |= getStreamByte(chunks[n].data(), chunkBits[n], (long long)(begin & ~(size_t)7) - (long long)begin);
+		}
+		if ((end & 7) && chunkBits[n] > 0) {
+			stream[end / 8] |= getStreamByte(chunks[n].data(), chunkBits[n], (long long)(end & ~(size_t)7) - (long long)begin);
+		}
+	}
+	// pad the last byte with 1-bits
+	if (totalBits & 7) {
+		stream[numBytes - 1] |= (1u << (8 - (totalBits & 7))) - 1;
+	}
+
+	// byte stuffing: count the 0xFF bytes per part, prefix sum, then copy the parts in parallel
+	size_t numParts = numChunks;
+	size_t bytesPerPart = (numBytes + numParts - 1) / numParts;
+	std::vector<size_t> partOffset(numParts + 1, 0);
+	pool.parallelFor(numParts, [&](size_t n) {
+		size_t end = std::min((n + 1) * bytesPerPart, numBytes);
+		partOffset[n + 1] = end - std::min(n * bytesPerPart, end) + std::count(stream.begin() + std::min(n * bytesPerPart, end), stream.begin() + end, (uint8_t)0xFF);
+	});
+	for (size_t n = 0; n < numParts; ++n) {
+		partOffset[n + 1] += partOffset[n];
+	}
+	uint8_t *out = writer.appendBytes(partOffset[numParts]);
+	pool.parallelFor(numParts, [&](size_t n) {
+		size_t end = std::min((n + 1) * bytesPerPart, numBytes);
+		uint8_t *p = out + partOffset[n];
+		for (size_t b = std::min(n * bytesPerPart, end); b < end; ++b) {
+			*p++ = stream[b];
+			if (stream[b] == 0xFF) {
+				*p++ = 0x00;
+			}
+		}
+	});
+}
+
+// Function to entropy code the quantized coefficients in row major or zigzag order (see encodeMCUs)
+// With a restart interval (in MCUs) > 0 the intervals are coded on the thread pool (if given),
+// otherwise a pool with more than one thread codes chunks of MCU rows that are stitched together
+// The standard tables of Annex K are used if no tables are given
+template <bool inZigZagOrder>
+static void encodeCoefficients(const coeff_image_t *coeffs, BitWriter& writer, unsigned int restartInterval, ThreadPool *pool, const HuffmanTableSet *huffmanTables) {
+	size_t mcusPerRow = getMCUsPerRow(coeffs);
+	size_t numMCUs = getNumMCUs(coeffs);
+	const HuffmanTableSet& tables = huffmanTables ? *huffmanTables : getStandardHuffmanTables();
+	EncodeMCUsFunc encodeMCUs = getEncodeMCUsFunc<inZigZagOrder>(coeffs);
+
+	if (restartInterval > 0) {
+		encodeRestartIntervals(numMCUs, restartInterval, pool, [&](size_t first, size_t end, BitWriter& segment) {
+			int lastDC[3] = {0, 0, 0};
+			encodeMCUs(coeffs, first, end, lastDC, tables, segment);
+		}, writer);
+	} else if (pool && pool->size() > 1 && numMCUs > 0) {
+		encodeChunksStitched(numMCUs, mcusPerRow, *pool, [&](size_t first, size_t end, BitWriter& chunk) {
+			// seed the DC predictors with the DC coefficients of the previous MCU
+			int lastDC[3] = {0, 0, 0};
+			if (first > 0) {
+				getMCUDC(coeffs, first - 1, lastDC);
+			}
+			encodeMCUs(coeffs, first, end, lastDC, tables, chunk);
+		}, writer);
+	} else {
+		int lastDC[3] = {0, 0, 0};
+		encodeMCUs(coeffs, 0, numMCUs, lastDC, tables, writer);
+	}
+	// pad the last byte with 1-bits
+	writer.flush();
+}
+
+// Function to entropy code the quantized image (zigzag, RLE and huffman encoding fused per block)
+// Reads every coefficient once, without intermediate per-block arrays or vectors
+void performEntropyCoding(const coeff_image_t *coeffs, BitWriter& writer, unsigned int restartInterval, ThreadPool *pool, const HuffmanTableSet *huffmanTables) {
+	encodeCoefficients<false>(coeffs, writer, restartInterval, pool, huffmanTables);
+}
+
+// Function to entropy code blocks that are already in zigzag order (e.g. the output of the zigzag kernel)
+void performEntropyCodingZigZag(const coeff_image_t *coeffs, BitWriter& writer, unsigned int restartInterval, ThreadPool *pool, const HuffmanTableSet *huffmanTables) {
+	encodeCoefficients<true>(coeffs, writer, restartInterval, pool, huffmanTables);
+}
+
+// Function to gather the symbol histograms of the four huffman tables (ordered as in HuffmanTableSet)
+// for the quantized image, i.e. the first pass of the coding with optimized tables. Chunks of MCU rows
+// are counted in parallel on the pool (if given) and the histograms are added up afterwards.
+void gatherHuffmanHistograms(const coeff_image_t *coeffs, unsigned int restartInterval, ThreadPool *pool, uint32_t histograms[4][256]) {
+	size_t mcusPerRow = getMCUsPerRow(coeffs);
+	size_t numMCUs = getNumMCUs(coeffs);
+	size_t numRows = mcusPerRow ? numMCUs / mcusPerRow : 0;
+	CountMCUSymbolsFunc countMCUSymbols = getCountMCUSymbolsFunc(coeffs);
+	size_t numChunks = pool ? std::min<size_t>(numRows, 4 * pool->size()) : 1;
+	size_t rowsPerChunk = numChunks ? (numRows + numChunks - 1) / numChunks : 0;
+	numChunks = rowsPerChunk ? (numRows + rowsPerChunk - 1) / rowsPerChunk : 0;
+	std::vector<uint32_t> chunkHistograms(numChunks * 4 * 256, 0);
+
+	auto countChunk = [&](size_t n) {
+		uint32_t *hist = &chunkHistograms[n * 4 * 256];
+		size_t first = n * rowsPerChunk * mcusPerRow;
+		size_t end = std::min(first + rowsPerChunk * mcusPerRow, numMCUs);
+		int lastDC[3] = {0, 0, 0};
+		if (first > 0) {
+			getMCUDC(coeffs, first - 1, lastDC);
+		}
+		countMCUSymbols(coeffs, first, end, restartInterval, lastDC, hist);
+	};
+	if (pool) {
+		pool->parallelFor(numChunks, countChunk);
+	} else {
+		for (size_t n = 0; n < numChunks; ++n) {
+			countChunk(n);
+		}
+	}
+
+	memset(histograms, 0, 4 * 256 * sizeof (uint32_t));
+	for (size_t n = 0; n < numChunks; ++n) {
+		for (size_t i = 0; i < 4 * 256; ++i) {
+			histograms[i / 256][i % 256] += chunkHistograms[n * 4 * 256 + i];
+		}
+	}
+}
+
+// Function to build a length-limited optimal huffman table from symbol frequencies (Annex K.2)
+// Writes BITS (codes per length 1..16) and HUFFVAL (symbols by increasing code length)
+void buildOptimalHuffmanTable(const uint32_t frequencies[256], uint8_t bits[16], uint8_t huffval[256], size_t *numValues) {
+	// symbol 256 is reserved with frequency 1, so that no real code consists only of 1-bits
+	uint64_t freq[257];
+	int codeSize[257];
+	int others[257];
+	for (int i = 0; i < 256; ++i) {
+		freq[i] = frequencies[i];
+	}
+	freq[256] = 1;
+	for (int i = 0; i < 257; ++i) {
+		codeSize[i] = 0;
+		others[i] = -1;
+	}
+
+	// Huffman procedure (Figure K.1): merge the two least frequent trees until one is left
+	for (;;) {
+		int c1 = -1;
+		int c2 = -1;
+		// c1 = least frequent symbol, ties are broken towards the larger symbol value
+		for (int i = 0; i < 257; ++i) {
+			if (freq[i] && (c1 < 0 || freq[i] <= freq[c1])) {
+				c1 = i;
+			}
+		}
+		// c2 = next least frequent symbol
+		for (int i = 0; i < 257; ++i) {
+			if (freq[i] && i != c1 && (c2 < 0 || freq[i] <= freq[c2])) {
+				c2 = i;
+			}
+		}
+		if (c2 < 0) {
+			break;
+		}
+
+		freq[c1] += freq[c2];
+		freq[c2] = 0;
+
+		codeSize[c1]++;
+		while (others[c1] >= 0) {
+			c1 = others[c1];
+			codeSize[c1]++;
+		}
+		others[c1] = c2;
+		codeSize[c2]++;
+		while (others[c2] >= 0) {
+			c2 = others[c2];
+			codeSize[c2]++;
+		}
+	}
+
+	// number of codes of each size (Figure K.2)
+	int count[33] = {0};
+	for (int i = 0; i < 257; ++i) {
+		if (codeSize[i]) {
+			count[codeSize[i] > 32 ? 32 : codeSize[i]]++;
+		}
+	}
+
+	// limit the code lengths to 16 bits (Figure K.3)
+	for (int i = 32; i > 16; --i) {
+		while (count[i] > 0) {
+			int j = i - 2;
+			while (count[j] == 0) {
+				--j;
+			}
+			count[i] -= 2;
+			count[i - 1]++;
+			count[j + 1] += 2;
+			count[j]--;
+		}
+	}
+	// remove the reserved code from the longest length
+	for (int i = 16; i > 0; --i) {
+		if (count[i]) {
+			count[i]--;
+			break;
+		}
+	}
+	for (int i = 0; i < 16; ++i) {
+		bits[i] = (uint8_t)count[i + 1];
+	}
+
+	// symbols sorted by code size (Figure K.4)
+	size_t k = 0;
+	for (int size = 1; size <= 32; ++size) {
+		for (int i = 0; i < 256; ++i) {
+			if (codeSize[i] == size) {
+				huffval[k++] = (uint8_t)i;
+			}
+		}
+	}
+	*numValues = k;
+}
+
+// Function to build the four optimized tables of a scan from the histograms of gatherHuffmanHistograms
+void buildOptimalHuffmanTables(const uint32_t histograms[4][256], HuffmanTableSet *tables) {
+	for (size_t t = 0; t < 4; ++t) {
+		buildOptimalHuffmanTable(histograms[t], tables->bits[t], tables->huffval[t], &tables->numValues[t]);
+		tables->codes[t] = buildHuffmanCodeTable(tables->bits[t], tables->huffval[t]);
+	}
+}
+
+// Function to get the standard tables of Annex K (K.3 - K.6)
+const HuffmanTableSet& getStandardHuffmanTables() {
+	static HuffmanTableSet tables;
+	static bool initialized = false;
+	if (!initialized) {
+		const uint8_t *bits[4] = { DC_LUMA_BITS, AC_LUMA_BITS, DC_CHROMA_BITS, AC_CHROMA_BITS };
+		const uint8_t *huffval[4] = { DC_LUMA_HUFFVAL, AC_LUMA_HUFFVAL, DC_CHROMA_HUFFVAL, AC_CHROMA_HUFFVAL };
+		const size_t numValues[4] = { sizeof(DC_LUMA_HUFFVAL), sizeof(AC_LUMA_HUFFVAL), sizeof(DC_CHROMA_HUFFVAL), sizeof(AC_CHROMA_HUFFVAL) };
+		const HuffmanCodeTable *codes[4] = { &DC_LUMA_HUFF_TABLE, &AC_LUMA_HUFF_TABLE, &DC_CHROMA_HUFF_TABLE, &AC_CHROMA_HUFF_TABLE };
+		for (size_t t = 0; t < 4; ++t) {
+			memcpy(tables.bits[t], bits[t], 16);
+			memset(tables.huffval[t], 0, 256);
+			memcpy(tables.huffval[t], huffval[t], numValues[t]);
+			tables.numValues[t] = numValues[t];
+			tables.codes[t] = *codes[t];
+		}
+		initialized = true;
+	}
+	return tables;
+}
+
+// Function to pack the four huffman code tables for the OpenCL kernels
+// Order: DC luma, AC luma, DC chroma, AC chroma, 256 entries each holding (length << 16) | code
+void getDeviceHuffmanTables(const HuffmanTableSet& huffmanTables, std::vector<cl_uint>& tables) {
+	tables.resize(4 * 256);
+	for (size_t t = 0; t < 4; ++t) {
+		for (size_t symbol = 0; symbol < 256; ++symbol) {
+			tables[t * 256 + symbol] = ((cl_uint)huffmanTables.codes[t].length[symbol] << 16) | huffmanTables.codes[t].code[symbol];
+		}
+	}
+}
+
+// Function to append a bit stream stored in 32 bit words (MSB first) to the writer, split into numIntervals
+// restart intervals that are already padded to whole bytes: interval n holds the bytes intervalOffsets[n] up to
+// intervalOffsets[n + 1]. The writer does the byte stuffing, the RST0..RST7 markers are inserted in between.
+void writeBitstreamWords(const cl_uint *words, const cl_uint *intervalOffsets, size_t numIntervals, BitWriter& writer) {
+	for (size_t n = 0; n < numIntervals; ++n) {
+		if (n > 0) {
+			writer.writeMarker(JPEG_MARKER_RST0 + ((n - 1) & 7));
+		}
+		size_t byte = intervalOffsets[n];
+		size_t end = intervalOffsets[n + 1];
+		// single bytes up to the next word, whole words, then the bytes of the last word
+		for (; byte < end && (byte & 3) != 0; ++byte) {
+			writer.writeBits((words[byte / 4] >> (24 - 8 * (byte & 3))) & 0xFF, 8);
+		}
+		for (; byte + 4 <= end; byte += 4) {
+			writer.writeBits(words[byte / 4], 32);
+		}
+		for (; byte < end; ++byte) {
+			writer.writeBits((words[byte / 4] >> (24 - 8 * (byte & 3))) & 0xFF, 8);
 		}
+		writer.flush();
 	}
 }
 
-// Function to restrucure the vector in RGBRGBRGB... to RRR...GGG...BBB...
-void switchVectorChannelOrdering(std::vector <cl_uint>& vInput, std::vector <cl_uint>& vOutput, const unsigned int width, const unsigned int height) {
+// Function to restrucure the vector in RRR...GGG...BBB... to RGBRGBRGB...
+// The second and third channel may be subsampled (see getPlaneOffset), their samples are repeated for every pixel they cover
+void switchVectorChannelOrdering(std::vector <cl_uint>& vInput, std::vector <cl_uint>& vOutput, const unsigned int width, const unsigned int height, const unsigned int subsamplingX, const unsigned int subsamplingY) {
+	size_t chromaWidth = getPlaneSize(width, subsamplingX, 1);
+	size_t offsetCb = getPlaneOffset(width, height, subsamplingX, subsamplingY, 1);
+	size_t offsetCr = getPlaneOffset(width, height, subsamplingX, subsamplingY, 2);
 	for (size_t y = 0; y < height * width; ++y) {
+		size_t chromaIndex = (y / width / subsamplingY) * chromaWidth + (y % width) / subsamplingX;
 		// place first channel in every third position starting with 0
 		vOutput[y * 3] = vInput[y];
 		// place second channel in every third position starting with 1
-		vOutput[y * 3 + 1] = vInput[y + width * height];
+		vOutput[y * 3 + 1] = vInput[offsetCb + chromaIndex];
 		// place third channel in every third position starting with 2
-		vOutput[y * 3 + 2] = vInput[y + width * height * 2];
+		vOutput[y * 3 + 2] = vInput[offsetCr + chromaIndex];
 	}
 }
 // Write ppm image to file (GPU)
@@ -3,6 +3,18 @@
 #include <cstdint>
 #include <iostream>
 #include <cstring>
+#include <vector>
+#include <string>
+
+#include "bitwriter.hpp"
+#include "threadpool.hpp"
+#include "huffman.hpp"
+#include "dct.hpp"
+#include "color.hpp"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 struct rgb_pixel {
     uint8_t r;
@@ -15,7 +27,8 @@ typedef struct rgb_pixel rgb_pixel_t;
 struct PPMimage {
     size_t width;
     size_t height;
-    rgb_pixel_t *data;
+    rgb_pixel_t *data;     // R, G and B per pixel, or one gray value per pixel (channels = 1)
+    unsigned int channels; // bytes per pixel of data: 3 = RGB (P6), 1 = gray (P5 or packed with packGrayscaleImage)
 };
 
 typedef struct PPMimage ppm_t;
@@ -38,6 +51,64 @@ struct PPMimage_d {
 
 typedef struct PPMimage_d ppm_d_t;
 
+// Function to get the width or height of a plane (0 = Y, 1 = Cb, 2 = Cr) from the one of the Y plane
+// 'subsampling' Y samples share one Cb and Cr sample, odd sizes are rounded up
+inline size_t getPlaneSize(size_t lumaSize, unsigned int subsampling, size_t channel) {
+    return (channel == 0) ? lumaSize : (lumaSize + subsampling - 1) / subsampling;
+}
+
+// Function to get the number of samples in front of a plane: the Y plane comes first,
+// followed by the Cb and Cr planes of equal size (channel 3 gives the size of all planes)
+inline size_t getPlaneOffset(size_t width, size_t height, unsigned int subsamplingX, unsigned int subsamplingY, size_t channel) {
+    size_t chromaSize = getPlaneSize(width, subsamplingX, 1) * getPlaneSize(height, subsamplingY, 1);
+    return (channel == 0) ? 0 : width * height + (channel - 1) * chromaSize;
+}
+
+// level shifted samples (-128..127) after the color space conversion: three planes (Y, Cb, Cr)
+// stored one after another in raster order. The Cb and Cr planes are smaller than the Y plane
+// after the chroma downsampling (subsampling 2, 2 for 4:2:0; 1, 1 before the downsampling).
+// Grayscale images only have the Y plane (numComponents = 1, subsampling 1, 1).
+struct SampleImage {
+    size_t width;               // of the Y plane
+    size_t height;              // of the Y plane
+    unsigned int subsamplingX;  // horizontal Y samples per Cb and Cr sample
+    unsigned int subsamplingY;  // vertical Y samples per Cb and Cr sample
+    unsigned int numComponents; // 3 = Y, Cb, Cr; 1 = Y (grayscale)
+    int8_t *data;               // getPlaneOffset(width, height, subsamplingX, subsamplingY, numComponents) samples
+};
+
+typedef struct SampleImage sample_image_t;
+
+// Function to get the samples of a channel (0 = Y, 1 = Cb, 2 = Cr)
+inline int8_t* getSamplePlane(const sample_image_t *img, size_t channel) {
+    return img->data + getPlaneOffset(img->width, img->height, img->subsamplingX, img->subsamplingY, channel);
+}
+
+// quantized DCT coefficients from the quantization to the entropy coding: three planes (Y, Cb, Cr)
+// with the geometry of the sample planes, each stored block after block in raster order with the 64
+// coefficients of a block next to each other (row major, or zigzag order after the zigzag scan).
+// Quantized coefficients of 8-bit samples fit into 16 bits.
+struct CoeffImage {
+    size_t width;               // of the Y plane in pixels, all planes are multiples of 8
+    size_t height;              // of the Y plane in pixels
+    unsigned int subsamplingX;  // horizontal Y samples per Cb and Cr sample
+    unsigned int subsamplingY;  // vertical Y samples per Cb and Cr sample
+    unsigned int numComponents; // 3 = Y, Cb, Cr; 1 = Y (grayscale)
+    int16_t *data;              // getPlaneOffset(width, height, subsamplingX, subsamplingY, numComponents) coefficients
+};
+
+typedef struct CoeffImage coeff_image_t;
+
+// Function to get the number of blocks in a row of a channel
+inline size_t getCoeffBlocksPerRow(const coeff_image_t *coeffs, size_t channel) {
+    return getPlaneSize(coeffs->width, coeffs->subsamplingX, channel) / 8;
+}
+
+// Function to get the coefficients of block 'block' (raster order) of a channel
+inline int16_t* getCoeffBlock(const coeff_image_t *coeffs, size_t channel, size_t block) {
+    return coeffs->data + getPlaneOffset(coeffs->width, coeffs->height, coeffs->subsamplingX, coeffs->subsamplingY, channel) + block * 64;
+}
+
 // for 50% quality
 const unsigned int quant_mat_lum[8][8] = {
     {16, 11, 10, 16, 24, 40, 51, 61},
@@ -61,6 +132,18 @@ const unsigned int quant_mat_chrom[8][8] = {
     {99, 99, 99, 99, 99, 99, 99, 99}
 };
 
+// row major index of the n-th coefficient in zigzag order
+const unsigned int zigzag_order[64] = {
+    0, 1, 8, 16, 9, 2, 3, 10,
+    17, 24, 32, 25, 18, 11, 4, 5,
+    12, 19, 26, 33, 40, 48, 41, 34,
+    27, 20, 13, 6, 7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36,
+    29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46,
+    53, 60, 61, 54, 47, 55, 62, 63
+};
+
 // struct to store cpu telemetry data
 struct CPUTelemetry {
     double CSCTime;
@@ -69,17 +152,71 @@ struct CPUTelemetry {
     double DCTTime;
     double QuantTime;
     double TotalCopyTime;
-    double zigZagTime;
-    double RLETime;
-    double HuffmanTime;
+    double entropyCodingTime;
+};
+
+// DCT implementations of the CPU path
+enum DCTMethod {
+    DCT_REFERENCE, // direct evaluation of the DCT formula (performDCT)
+    DCT_AAN,       // separable fast DCT of Arai, Agui and Nakajima (scalar, single precision), with the quantization folded into its post-scale
+    DCT_SIMD,      // single precision AAN DCT with SSE4.1/AVX2 (picked at runtime), fused with the quantization
+    DCT_INT        // fixed-point integer DCT, bit-identical on every instruction set and the GPU
 };
 
-int readPPMImage(const char *, size_t *, size_t *, rgb_pixel_t **);
-int writePPMImage(const char *, size_t, size_t, rgb_pixel_t *);
+// chroma subsampling: Y samples per Cb and Cr sample horizontally x vertically
+enum ChromaSubsampling {
+    CHROMA_444, // 1x1, no subsampling
+    CHROMA_422, // 2x1
+    CHROMA_420, // 2x2
+    CHROMA_440  // 1x2
+};
+
+// DCT kernels of the GPU path
+enum GPUDCTKernel {
+    GPU_DCT_NAIVE, // DCTKernel: every work item evaluates the DCT formula for its coefficient
+    GPU_DCT_TILED  // DCTTiledKernel: separable row and column passes over 8x8 tiles in local memory
+};
+
+// kernels of the GPU path from the RGB planes to the quantized coefficients in zigzag order
+enum GPUPipeline {
+    GPU_PIPELINE_STAGES, // one kernel per stage with the intermediate results read back and checked on the host
+    GPU_PIPELINE_FUSED   // encodeMCUKernel: one work group per MCU, the intermediate results stay in local memory
+};
+
+// encoder settings that can be changed from the command line
+struct EncoderOptions {
+    unsigned int restartInterval; // MCUs per restart interval, 0 = no restart markers
+    unsigned int numThreads;      // threads for the entropy coding, 0 = all cores, 1 = serial
+    bool optimizeHuffman;         // two passes with huffman tables optimized for the image instead of Annex K
+    bool checkGPU;                // read the intermediate results of the GPU path back and check them on the host,
+                                  // and check the accuracy of the CSC and the DCT of the CPU path
+    DCTMethod dctMethod;          // DCT implementation of the CPU path
+    GPUDCTKernel gpuDCTKernel;    // DCT kernel of the GPU path (not used by the integer DCT)
+    GPUPipeline gpuPipeline;      // per-stage kernels or the fused kernel up to the entropy coding
+    ChromaSubsampling chromaSubsampling; // chroma subsampling of the CPU and the GPU path (not used for grayscale images)
+    const char *inputFile;        // PPM (P6) or PGM (P5) image to encode
+    cl_device_type deviceType;    // OpenCL device type for the GPU pipeline (a CPU device allows testing with e.g. POCL)
+};
+
+int parseEncoderOptions(int, char **, EncoderOptions *);
+
+// allocator of the pixels of an image: gets the width, the height, the bytes per pixel and a user pointer, returns NULL on failure
+typedef rgb_pixel_t *(*PixelAllocator)(size_t, size_t, unsigned int, void *);
+
+rgb_pixel_t *allocatePixels(size_t, size_t, unsigned int, void *);
+int readPPMImage(const char *, size_t *, size_t *, rgb_pixel_t **, unsigned int *);
+int readPPMImageInto(const char *, size_t *, size_t *, rgb_pixel_t **, unsigned int *, PixelAllocator, void *);
+bool isGrayscaleImage(const ppm_t *);
+void packGrayscaleImage(ppm_t *);
+int writePPMImage(const char *, size_t, size_t, rgb_pixel_t *, unsigned int = 3);
 void removeRedChannel(ppm_t *);
 
 void performCSC(ppm_t *);
 void performCDS(ppm_t *);
+void performCSCFixed(const ppm_t *, sample_image_t *, SimdLevel);
+void performGrayscaleConversion(const ppm_t *, sample_image_t *);
+void performCSCFused(const ppm_t *, sample_image_t *, ChromaSubsampling, SimdLevel);
+bool checkCSCAccuracy();
 
 rgb_pixel_t* getPixelPtr(ppm_t *, size_t, size_t);
 rgb_pixel_t getPixel(ppm_t *, size_t, size_t);
@@ -95,15 +232,25 @@ void copyUIntToDoubleImage(ppm_t *, ppm_d_t *);
 void copyDoubleToUIntImage(ppm_d_t *, ppm_t *);
 
 void copyToLargerImage(ppm_t *, ppm_t *);
+void copyToLargerSampleImage(const sample_image_t *, sample_image_t *);
+void copySamplesToUIntImage(const sample_image_t *, ppm_t *);
 void getNearest8x8ImageSize(size_t, size_t, size_t *, size_t *);
+void getPaddedImageSize(size_t, size_t, unsigned int, unsigned int, size_t *, size_t *);
 void addReversedPadding(ppm_t *, size_t, size_t);
 void substractfromAll(ppm_d_t *, double);
 
 void performDCT(ppm_d_t *);
 void performDCTBlock(ppm_d_t *, size_t, size_t);
 void performDCT2(ppm_d_t *);
+void performDCTQuantizationPlanar(const sample_image_t *, const unsigned int[][8], const unsigned int[][8], DCTMethod, SimdLevel, coeff_image_t *);
+bool checkDCTAccuracy(DCTMethod, const unsigned int[][8], const unsigned int[][8]);
+const char* getDCTMethodName(DCTMethod);
+const char* getGPUDCTKernelName(GPUDCTKernel);
+const char* getGPUPipelineName(GPUPipeline);
+const char* getChromaSubsamplingName(ChromaSubsampling);
+void getChromaSubsamplingFactors(ChromaSubsampling, unsigned int *, unsigned int *);
+ChromaSubsampling getChromaSubsampling(unsigned int, unsigned int);
 
-void performQuantization(ppm_d_t *, const unsigned int[][8], const unsigned int[][8]);
 
 void previewImage(ppm_t *, size_t, size_t, size_t, size_t, std::string = "");
 void previewImageD(ppm_d_t *, size_t, size_t, size_t, size_t, std::string = "");
@@ -113,10 +260,8 @@ void previewImageLinearI(std::vector <int>&, const unsigned int, const unsigned
 void previewImageLinearD(std::vector <float>&, const unsigned int, const unsigned int, size_t , size_t , size_t , size_t, std::string msg = "");
 
 void printMsg(std::string);
-void copyImageToVector(ppm_t *, std::vector <cl_uint>&);
 
-void copyOntoLargerVectorWithPadding(std::vector <cl_uint>&, std::vector <cl_uint>&, const unsigned int, const unsigned int, const unsigned int, const unsigned int);
-void switchVectorChannelOrdering(std::vector <cl_uint>&, std::vector <cl_uint>&, const unsigned int, const unsigned int);
+void switchVectorChannelOrdering(std::vector <cl_uint>&, std::vector <cl_uint>&, const unsigned int, const unsigned int, const unsigned int, const unsigned int);
 void writeVectorToFile(const char *, const unsigned int, const unsigned int, std::vector <cl_uint>&);
 
 void everyMCUisnow2DArray(ppm_d_t *, int [][64]);
@@ -128,10 +273,54 @@ void performZigZag(int [][64], int [][64], int);
 
 void seperateChannels(int [][64], int [][64], int [][64], int [][64], int);
 
-void RLEBlockAC(int [], std::vector<int> ,int); 
+void RLEBlockAC(int [], std::vector<int>&);
 void performRLE(int [][64], std::vector<std::vector<int>>&,int);
 
-const int16_t getValueCategory(const int16_t);
-const std::string valueToBitString(const int16_t);
+// magnitude bits of a coefficient and their number (= the category of the value)
+struct value_bits {
+    uint32_t bits;
+    unsigned int length;
+};
+
+typedef struct value_bits value_bits_t;
+
+// Function to count the leading zero bits of a non-zero 32 bit value
+inline unsigned int countLeadingZeros(uint32_t value) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse(&index, value);
+    return 31 - index;
+#else
+    return __builtin_clz(value);
+#endif
+}
+
+// Function to get the category (number of magnitude bits) of the given value
+inline unsigned int getValueCategory(int value) {
+    int sign = value >> 31;
+    uint32_t magnitude = (value ^ sign) - sign;
+    // (magnitude << 1) | 1 is never zero, so no branch is needed for value == 0
+    return 31 - countLeadingZeros((magnitude << 1) | 1);
+}
+
+// Function to get the magnitude bits of the given value
+// Negative values are stored as the one's complement of their magnitude, i.e. value - 1
+inline value_bits_t valueToBits(int value) {
+    value_bits_t result;
+    result.length = getValueCategory(value);
+    result.bits = (uint32_t)(value + (value >> 31)) & ((1u << result.length) - 1);
+    return result;
+}
+
+bool checkHuffmanTables();
+void HuffmanEncoder(int [][64], std::vector<std::vector<int>>&, int, BitWriter&);
+void performEntropyCoding(const coeff_image_t *, BitWriter&, unsigned int = 0, ThreadPool * = NULL, const HuffmanTableSet * = NULL);
+void performEntropyCodingZigZag(const coeff_image_t *, BitWriter&, unsigned int = 0, ThreadPool * = NULL, const HuffmanTableSet * = NULL);
+
+void gatherHuffmanHistograms(const coeff_image_t *, unsigned int, ThreadPool *, uint32_t [4][256]);
+void buildOptimalHuffmanTable(const uint32_t [256], uint8_t [16], uint8_t [256], size_t *);
+void buildOptimalHuffmanTables(const uint32_t [4][256], HuffmanTableSet *);
+const HuffmanTableSet& getStandardHuffmanTables();
 
-std::string HuffmanEncoder(int [][64], std::vector<std::vector<int>>&, int);
\ No newline at end of file
+void getDeviceHuffmanTables(const HuffmanTableSet&, std::vector<cl_uint>&);
+void writeBitstreamWords(const cl_uint *, const cl_uint *, size_t, BitWriter&);
\ No newline at end of file